@@ -22,6 +22,8 @@
 
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <unistd.h>
 #endif
 
 #ifdef ENABLE_BROWSER_QT_LOOP
@@ -95,7 +97,9 @@ void BrowserApp::OnBeforeCommandLineProcessing(const CefString &, CefRefPtr<CefC
 #ifdef __APPLE__
 	command_line->AppendSwitch("use-mock-keychain");
 #elif !defined(_WIN32)
-	command_line->AppendSwitchWithValue("ozone-platform", wayland ? "wayland" : "x11");
+	/* the offline renderer asks for the headless platform itself */
+	if (!command_line->HasSwitch("ozone-platform"))
+		command_line->AppendSwitchWithValue("ozone-platform", wayland ? "wayland" : "x11");
 #endif
 }
 
@@ -105,10 +109,24 @@ std::vector<std::string> exposedFunctions = {"getControlLevel",     "getCurrentS
 					     "startReplayBuffer",   "stopReplayBuffer", "saveReplayBuffer",
 					     "startVirtualcam",     "stopVirtualcam",   "getScenes",
 					     "setCurrentScene",     "getTransitions",   "getCurrentTransition",
-					     "setCurrentTransition"};
+					     "setCurrentTransition", "snapshotReady",    "setFrameRate",
+					     "pause",               "resume",           "requestFrame"};
 
-void BrowserApp::OnContextCreated(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame>, CefRefPtr<CefV8Context> context)
+void BrowserApp::OnContextCreated(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
+				  CefRefPtr<CefV8Context> context)
 {
+#if !defined(_WIN32) && !defined(__APPLE__)
+	/* for the CPU governor, which samples the renderers' CPU time.  They
+	 * run unsandboxed, so this is the pid as seen by OBS. */
+	if (frame->IsMain()) {
+		CefRefPtr<CefProcessMessage> msg = CefProcessMessage::Create("rendererPid");
+		msg->GetArgumentList()->SetInt(0, (int)getpid());
+		SendBrowserProcessMessage(browser, PID_BROWSER, msg);
+	}
+#else
+	UNUSED_PARAMETER(frame);
+#endif
+
 	CefRefPtr<CefV8Value> globalObj = context->GetGlobal();
 
 	CefRefPtr<CefV8Value> obsStudioObj = CefV8Value::CreateObject(nullptr, nullptr);
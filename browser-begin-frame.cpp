@@ -0,0 +1,179 @@
+#include "browser-begin-frame.hpp"
+
+#include <util/platform.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+extern bool QueueCEFTask(std::function<void()> task);
+
+/* Margin on top of the average paint time, and the smallest lead used */
+#define LEAD_MARGIN_NS 2000000ULL
+#define MIN_LEAD_NS 3000000ULL
+
+static inline void Average(std::atomic<uint64_t> &avg, uint64_t val)
+{
+	const uint64_t prev = avg.load(std::memory_order_relaxed);
+	avg.store(prev ? prev - prev / 8 + val / 8 : val, std::memory_order_relaxed);
+}
+
+uint64_t BeginFrameTiming::Lead(uint64_t interval)
+{
+	const uint64_t paint = paint_ns.load(std::memory_order_relaxed);
+
+	/* nothing painted yet, start in the middle of the interval */
+	uint64_t lead = paint ? paint + paint / 4 + LEAD_MARGIN_NS : interval / 2;
+	lead = std::max<uint64_t>(lead, MIN_LEAD_NS);
+
+	lead_ns.store(lead, std::memory_order_relaxed);
+	return lead;
+}
+
+bool BeginFrameTiming::Outstanding(uint64_t ts, uint64_t interval)
+{
+	if (!scheduled)
+		return false;
+	if (ts - requested_ts.load(std::memory_order_relaxed) < interval * 2)
+		return true;
+
+	scheduled = false;
+	return false;
+}
+
+void BeginFrameTiming::OnRequest(uint64_t ts)
+{
+	requested_ts.store(ts, std::memory_order_relaxed);
+	scheduled = true;
+
+	if (!rate_window_ts)
+		rate_window_ts = ts;
+	rate_window_count++;
+
+	if (ts - rate_window_ts >= 1000000000ULL) {
+		rate.store((double)rate_window_count * 1e9 / (double)(ts - rate_window_ts),
+			   std::memory_order_relaxed);
+		rate_window_ts = ts;
+		rate_window_count = 0;
+	}
+}
+
+void BeginFrameTiming::OnPaint(uint64_t ts)
+{
+	/* the first paint after the begin frame was sent is its own; one
+	 * still waiting in the scheduler has not been sent yet */
+	const uint64_t sent = sent_ts.load(std::memory_order_acquire);
+	if (!sent || ts < sent || painted.exchange(true))
+		return;
+
+	scheduled = false;
+
+	Average(paint_ns, ts - sent);
+
+	/* arrived in time for the render of the frame it was meant for */
+	if (ts <= target_ts.load(std::memory_order_relaxed))
+		on_time++;
+	else
+		late++;
+}
+
+void BeginFrameTiming::OnRender(uint64_t ts)
+{
+	const uint64_t sent = sent_ts.load(std::memory_order_acquire);
+	if (!painted.exchange(false) || ts < sent)
+		return;
+
+	Average(latency_ns, ts - sent);
+}
+
+void SendBeginFrameBatch(std::vector<BeginFrameRequest> requests)
+{
+	if (requests.empty())
+		return;
+
+	QueueCEFTask([requests]() {
+		for (const BeginFrameRequest &request : requests) {
+			request.timing->painted = false;
+			request.timing->sent_ts.store(os_gettime_ns(), std::memory_order_release);
+			request.browser->GetHost()->SendExternalBeginFrame();
+		}
+	});
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct ScheduledBeginFrame {
+	uint64_t ts;
+	BeginFrameRequest request;
+};
+
+static std::mutex scheduler_mutex;
+static std::condition_variable scheduler_cv;
+static std::vector<ScheduledBeginFrame> scheduled_frames;
+static std::thread scheduler_thread;
+static bool scheduler_stop = false;
+
+static void BeginFrameSchedulerThread()
+{
+	os_set_thread_name("obs-browser: begin frame scheduler");
+
+	std::unique_lock<std::mutex> lock(scheduler_mutex);
+
+	while (!scheduler_stop) {
+		if (scheduled_frames.empty()) {
+			scheduler_cv.wait(lock);
+			continue;
+		}
+
+		uint64_t next = UINT64_MAX;
+		for (const ScheduledBeginFrame &frame : scheduled_frames)
+			next = std::min(next, frame.ts);
+
+		const uint64_t now = os_gettime_ns();
+		if (next > now) {
+			scheduler_cv.wait_for(lock, std::chrono::nanoseconds(next - now));
+			continue;
+		}
+
+		/* everything due within a millisecond goes in the same task */
+		std::vector<BeginFrameRequest> due;
+		auto it = std::partition(scheduled_frames.begin(), scheduled_frames.end(),
+					 [now](const ScheduledBeginFrame &frame) { return frame.ts > now + 1000000; });
+		for (auto due_it = it; due_it != scheduled_frames.end(); ++due_it)
+			due.push_back(std::move(due_it->request));
+		scheduled_frames.erase(it, scheduled_frames.end());
+
+		lock.unlock();
+		SendBeginFrameBatch(std::move(due));
+		lock.lock();
+	}
+
+	scheduled_frames.clear();
+}
+
+void ScheduleBeginFrame(BeginFrameRequest request, uint64_t ts)
+{
+	std::lock_guard<std::mutex> lock(scheduler_mutex);
+
+	if (scheduler_stop)
+		return;
+	if (!scheduler_thread.joinable())
+		scheduler_thread = std::thread(BeginFrameSchedulerThread);
+
+	scheduled_frames.push_back({ts, std::move(request)});
+	scheduler_cv.notify_one();
+}
+
+void StopBeginFrameScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(scheduler_mutex);
+		scheduler_stop = true;
+		scheduler_cv.notify_one();
+	}
+
+	if (scheduler_thread.joinable())
+		scheduler_thread.join();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "cef-headers.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/* Timing of the begin frames sent to one browser, shared between the
+ * threads sending them, painting and rendering.  The lead time, i.e. how
+ * long before the OBS frame it is meant for a begin frame is sent, follows
+ * how long the browser takes to paint. */
+struct BeginFrameTiming {
+	/* set when a begin frame is requested, until its paint arrives */
+	std::atomic<bool> scheduled = false;
+	std::atomic<bool> painted = false;
+	std::atomic<uint64_t> requested_ts = 0;
+	/* OBS frame the last begin frame was sent for */
+	std::atomic<uint64_t> target_ts = 0;
+	std::atomic<uint64_t> sent_ts = 0;
+
+	std::atomic<uint64_t> lead_ns = 0;
+	/* averages of begin frame to paint, and begin frame to render */
+	std::atomic<uint64_t> paint_ns = 0;
+	std::atomic<uint64_t> latency_ns = 0;
+	std::atomic<uint64_t> on_time = 0;
+	std::atomic<uint64_t> late = 0;
+
+	/* begin frames requested per second, over the last second */
+	std::atomic<double> rate = 0.0;
+	uint64_t rate_window_ts = 0;
+	uint64_t rate_window_count = 0;
+
+	/* lead time to use for a frame interval, updates lead_ns */
+	uint64_t Lead(uint64_t interval);
+
+	/* graphics thread, whether the paint of the last begin frame has yet
+	 * to arrive.  Whether the paint was rendered does not matter: the
+	 * tick runs right before the render, which takes it.  A begin frame
+	 * is given up on after two intervals, as a page where nothing
+	 * changed does not paint. */
+	bool Outstanding(uint64_t ts, uint64_t interval);
+	/* graphics thread, a begin frame is requested */
+	void OnRequest(uint64_t ts);
+
+	/* CEF UI thread, a view paint arrived */
+	void OnPaint(uint64_t ts);
+	/* graphics thread, a painted frame was consumed */
+	void OnRender(uint64_t ts);
+};
+
+struct BeginFrameRequest {
+	CefRefPtr<CefBrowser> browser;
+	std::shared_ptr<BeginFrameTiming> timing;
+};
+
+/* Sends the begin frames in a single CEF task */
+void SendBeginFrameBatch(std::vector<BeginFrameRequest> requests);
+
+/* Sends a begin frame at ts (os_gettime_ns), from a scheduler thread */
+void ScheduleBeginFrame(BeginFrameRequest request, uint64_t ts);
+
+void StopBeginFrameScheduler();
@@ -18,11 +18,14 @@
 
 #include "browser-client.hpp"
 #include "obs-browser-source.hpp"
+#include "browser-convert.hpp"
+#include "browser-frame.hpp"
 #include "base64/base64.hpp"
 #include <nlohmann/json.hpp>
 #include <obs-frontend-api.h>
 #include <obs.hpp>
 #include <util/platform.h>
+#include <algorithm>
 #include <QApplication>
 #include <QThread>
 #include <QToolTip>
@@ -112,6 +115,10 @@ void BrowserClient::OnRenderProcessTerminated(CefRefPtr<CefBrowser>, Termination
 
 	blog(LOG_ERROR, "[obs-browser: '%s'] Webpage has crashed unexpectedly! Reason: '%s'", sourceName,
 	     str_text.c_str());
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+	bs->renderer_pid = 0;
+#endif
 }
 
 CefResourceRequestHandler::ReturnValue BrowserClient::OnBeforeResourceLoad(CefRefPtr<CefBrowser>, CefRefPtr<CefFrame>,
@@ -152,6 +159,14 @@ bool BrowserClient::OnProcessMessageReceived(CefRefPtr<CefBrowser> browser, CefR
 		return false;
 	}
 
+#if !defined(_WIN32) && !defined(__APPLE__)
+	/* not a page call, sent by the renderer itself */
+	if (name == "rendererPid") {
+		bs->renderer_pid = input_args->GetInt(0);
+		return true;
+	}
+#endif
+
 	// Fall-through switch, so that higher levels also have lower-level rights
 	switch (webpage_control_level) {
 	case ControlLevel::All:
@@ -266,11 +281,27 @@ bool BrowserClient::OnProcessMessageReceived(CefRefPtr<CefBrowser> browser, CefR
 				{"recordingPaused", obs_frontend_recording_paused()},
 				{"replaybuffer", obs_frontend_replay_buffer_active()},
 				{"virtualcam", obs_frontend_virtualcam_active()}};
+		} else if (name == "setFrameRate") {
+			double rate = 0.0;
+			if (input_args->GetType(1) == VTYPE_INT)
+				rate = input_args->GetInt(1);
+			else if (input_args->GetType(1) == VTYPE_DOUBLE)
+				rate = input_args->GetDouble(1);
+			bs->SetPageFrameRate(rate);
+			json = bs->page_frame_rate.load();
+		} else if (name == "pause") {
+			bs->SetPagePaused(true);
+		} else if (name == "resume") {
+			bs->SetPagePaused(false);
+		} else if (name == "requestFrame") {
+			bs->RequestPageFrame();
 		}
 		[[fallthrough]];
 	case ControlLevel::None:
 		if (name == "getControlLevel") {
 			json = (int)webpage_control_level;
+		} else if (name == "snapshotReady") {
+			bs->snapshot_ready_ts = os_gettime_ns();
 		}
 	}
 
@@ -295,6 +326,22 @@ void BrowserClient::GetViewRect(CefRefPtr<CefBrowser>, CefRect &rect)
 	rect.Set(0, 0, bs->width < 1 ? 1 : bs->width, bs->height < 1 ? 1 : bs->height);
 }
 
+bool BrowserClient::GetScreenInfo(CefRefPtr<CefBrowser> browser, CefScreenInfo &screen_info)
+{
+	if (!valid())
+		return false;
+
+	/* the view keeps its logical size, pages are rasterized at the
+	 * displayed size through the device scale factor */
+	CefRect rect;
+	GetViewRect(browser, rect);
+
+	screen_info.device_scale_factor = bs->device_scale;
+	screen_info.rect = rect;
+	screen_info.available_rect = rect;
+	return true;
+}
+
 bool BrowserClient::OnTooltip(CefRefPtr<CefBrowser>, CefString &text)
 {
 	std::string str_text = text;
@@ -303,14 +350,45 @@ bool BrowserClient::OnTooltip(CefRefPtr<CefBrowser>, CefString &text)
 	return true;
 }
 
-void BrowserClient::OnPaint(CefRefPtr<CefBrowser>, PaintElementType type, const RectList &, const void *buffer,
-			    int width, int height)
+void BrowserClient::OnPopupShow(CefRefPtr<CefBrowser>, bool show)
 {
-	if (type != PET_VIEW) {
-		// TODO Overlay texture on top of bs->texture
+	if (show || !valid())
 		return;
-	}
 
+	popupRect.Set(0, 0, 0, 0);
+	originalPopupRect.Set(0, 0, 0, 0);
+	bs->SetPopupRect(FrameRect());
+}
+
+void BrowserClient::OnPopupSize(CefRefPtr<CefBrowser>, const CefRect &rect)
+{
+	if (!valid() || rect.width <= 0 || rect.height <= 0)
+		return;
+
+	originalPopupRect = rect;
+	popupRect = rect;
+
+	/* keep the popup inside the view */
+	const int view_cx = std::max(bs->width, 1);
+	const int view_cy = std::max(bs->height, 1);
+	if (popupRect.x + popupRect.width > view_cx)
+		popupRect.x = view_cx - popupRect.width;
+	if (popupRect.y + popupRect.height > view_cy)
+		popupRect.y = view_cy - popupRect.height;
+	popupRect.x = std::max(popupRect.x, 0);
+	popupRect.y = std::max(popupRect.y, 0);
+
+	FrameRect popup;
+	popup.x = (uint32_t)popupRect.x;
+	popup.y = (uint32_t)popupRect.y;
+	popup.cx = (uint32_t)popupRect.width;
+	popup.cy = (uint32_t)popupRect.height;
+	bs->SetPopupRect(popup);
+}
+
+void BrowserClient::OnPaint(CefRefPtr<CefBrowser>, PaintElementType type, const RectList &dirtyRects,
+			    const void *buffer, int width, int height)
+{
 #ifdef ENABLE_BROWSER_SHARED_TEXTURE
 	if (sharing_available) {
 		return;
@@ -321,23 +399,133 @@ void BrowserClient::OnPaint(CefRefPtr<CefBrowser>, PaintElementType type, const
 		return;
 	}
 
-	if (bs->width != width || bs->height != height) {
-		obs_enter_graphics();
-		bs->DestroyTextures();
-		obs_leave_graphics();
+	if (!width || !height)
+		return;
+
+	std::vector<FrameRect> rects;
+	rects.reserve(dirtyRects.size());
+
+	for (const CefRect &dirty : dirtyRects) {
+		FrameRect rect;
+		rect.x = (uint32_t)std::max(dirty.x, 0);
+		rect.y = (uint32_t)std::max(dirty.y, 0);
+		rect.cx = (uint32_t)std::max(dirty.width, 0);
+		rect.cy = (uint32_t)std::max(dirty.height, 0);
+		if (ClipFrameRect(rect, (uint32_t)width, (uint32_t)height))
+			rects.push_back(rect);
+	}
+
+	if (type == PET_POPUP) {
+		/* composited over the view in BrowserSource::Render, so the
+		 * view itself never has to be uploaded again for it */
+		FrameRect bounds;
+		bounds.cx = (uint32_t)width;
+		bounds.cy = (uint32_t)height;
+		const std::vector<FrameRect> live(1, bounds);
+
+		if (bs->popup_frames.Push((const uint8_t *)buffer, (uint32_t)width * 4, (uint32_t)width,
+					  (uint32_t)height, rects, bounds, live))
+			bs->stats.frames_dropped++;
+		return;
 	}
 
-	if (!bs->texture && width && height) {
-		obs_enter_graphics();
-		bs->texture = gs_texture_create(width, height, GS_BGRA, 1, (const uint8_t **)&buffer, GS_DYNAMIC);
-		bs->width = width;
-		bs->height = height;
-		obs_leave_graphics();
+	if (bs->cpu_begin_frames)
+		bs->begin_frame_timing->OnPaint(os_gettime_ns());
+
+	if (bs->frame_snapshot_pending)
+		bs->ServeFrameSnapshots((const uint8_t *)buffer, (uint32_t)width, (uint32_t)height);
+	if (bs->page_frame_pending)
+		bs->FinishPageFrame();
+
+	if (bs->skip_duplicates) {
+		const uint64_t start_ns = os_gettime_ns();
+		const bool changed = tiles.Update((const uint8_t *)buffer, (uint32_t)width * 4, (uint32_t)width,
+						  (uint32_t)height, rects);
+		bs->stats.hash_ns += os_gettime_ns() - start_ns;
+
+		if (!changed) {
+			bs->stats.duplicate_frames++;
+			return;
+		}
+	}
+
+	bs->MarkPaint();
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+	if (frame_export)
+		frame_export->Publish((const uint8_t *)buffer, (uint32_t)width * 4, (uint32_t)width, (uint32_t)height,
+				      opaque, os_gettime_ns());
+#endif
+
+	if (bs->async_video) {
+		/* the audio packets are stamped with CEF's monotonic clock in
+		 * milliseconds, which is the clock os_gettime_ns reads */
+		struct obs_source_frame frame = {};
+		frame.width = (uint32_t)width;
+		frame.height = (uint32_t)height;
+		frame.timestamp = os_gettime_ns();
+
+		if (opaque) {
+			/* no alpha to keep, so libobs gets NV12 in the output's
+			 * range, less than half the size of BGRA */
+			struct obs_video_info ovi;
+			const bool full_range = obs_get_video_info(&ovi) && ovi.range == VIDEO_RANGE_FULL;
+			const uint32_t uv_cx = ((uint32_t)width + 1) / 2 * 2;
+			const uint32_t uv_cy = ((uint32_t)height + 1) / 2;
+			yuv_buffer.resize((size_t)width * height + (size_t)uv_cx * uv_cy);
+
+			frame.data[0] = yuv_buffer.data();
+			frame.data[1] = yuv_buffer.data() + (size_t)width * height;
+			frame.linesize[0] = (uint32_t)width;
+			frame.linesize[1] = uv_cx;
+			frame.format = VIDEO_FORMAT_NV12;
+			frame.full_range = full_range;
+			video_format_get_parameters_for_format(VIDEO_CS_709,
+							       full_range ? VIDEO_RANGE_FULL : VIDEO_RANGE_PARTIAL,
+							       frame.format, frame.color_matrix, frame.color_range_min,
+							       frame.color_range_max);
+
+			const uint64_t start_ns = os_gettime_ns();
+			ConvertBGRAToNV12((const uint8_t *)buffer, (uint32_t)width * 4, (uint32_t)width,
+					  (uint32_t)height, frame.data[0], frame.linesize[0], frame.data[1],
+					  frame.linesize[1], full_range);
+			bs->stats.convert_ns += os_gettime_ns() - start_ns;
+		} else {
+			frame.data[0] = (uint8_t *)buffer;
+			frame.linesize[0] = (uint32_t)width * 4;
+			frame.format = VIDEO_FORMAT_BGRA;
+			frame.full_range = true;
+		}
+
+		std::lock_guard<std::mutex> lock(bs->video_source_mutex);
+		if (bs->video_source)
+			obs_source_output_video(bs->video_source, &frame);
+		bs->stats.async_frames++;
+		return;
+	}
+
+	/* loop mode records from the moment the page has loaded */
+	if (bs->loop_capture && bs->snapshot_load_ts)
+		bs->loop.Record((const uint8_t *)buffer, (uint32_t)width * 4, (uint32_t)width, (uint32_t)height, rects,
+				os_gettime_ns(), (uint64_t)bs->loop_duration * 1000000ULL,
+				(size_t)bs->loop_memory_cap * 1024 * 1024);
+
+	/* opaque pages are visible everywhere, no need to scan them */
+	FrameRect bounds;
+	std::vector<FrameRect> live;
+	if (opaque) {
+		bounds.cx = (uint32_t)width;
+		bounds.cy = (uint32_t)height;
+		live.push_back(bounds);
 	} else {
-		obs_enter_graphics();
-		gs_texture_set_image(bs->texture, (const uint8_t *)buffer, width * 4, false);
-		obs_leave_graphics();
+		bounds = alpha_bounds.Update((const uint8_t *)buffer, (uint32_t)width * 4, (uint32_t)width,
+					     (uint32_t)height, rects, live);
 	}
+
+	/* the upload happens on the graphics thread in BrowserSource::Render */
+	if (bs->frames.Push((const uint8_t *)buffer, (uint32_t)width * 4, (uint32_t)width, (uint32_t)height, rects,
+			    bounds, live))
+		bs->stats.frames_dropped++;
 }
 
 #ifdef ENABLE_BROWSER_SHARED_TEXTURE
@@ -353,17 +541,19 @@ void BrowserClient::UpdateExtraTexture()
 			if (!bs->extra_texture || bs->last_format != linear_format || bs->last_cx != cx ||
 			    bs->last_cy != cy) {
 				if (bs->extra_texture) {
-					gs_texture_destroy(bs->extra_texture);
+					ReleasePooledTexture(bs->extra_texture);
 					bs->extra_texture = nullptr;
 				}
-				bs->extra_texture = gs_texture_create(cx, cy, linear_format, 1, nullptr, 0);
+				bs->extra_texture = AcquirePooledTexture(cx, cy, linear_format, 0);
+				bs->copied_generation = BrowserSource::NO_GENERATION;
 				bs->last_cx = cx;
 				bs->last_cy = cy;
 				bs->last_format = linear_format;
 			}
 		} else if (bs->extra_texture) {
-			gs_texture_destroy(bs->extra_texture);
+			ReleasePooledTexture(bs->extra_texture);
 			bs->extra_texture = nullptr;
+			bs->copied_generation = BrowserSource::NO_GENERATION;
 			bs->last_cx = 0;
 			bs->last_cy = 0;
 			bs->last_format = GS_UNKNOWN;
@@ -378,16 +568,25 @@ void BrowserClient::OnAcceleratedPaint(CefRefPtr<CefBrowser>, PaintElementType t
 				       void *shared_handle)
 #endif
 {
-	if (type != PET_VIEW) {
-		// TODO Overlay texture on top of bs->texture
+	if (!valid()) {
 		return;
 	}
 
-	if (!valid()) {
-		return;
+	/* popups get their own shared texture, composited over the view by
+	 * RenderPopup like CPU painted ones */
+	const bool popup = type == PET_POPUP;
+	gs_texture_t *&texture = popup ? bs->popup_texture : bs->texture;
+
+	if (!popup) {
+		/* the shared texture may have been updated in place */
+		bs->frame_generation++;
+		bs->FinishPageFrame();
+		bs->MarkPaint();
 	}
 
 #if !defined(_WIN32) && !defined(__APPLE__)
+	DmabufTextureCache &dmabuf_cache = popup ? bs->popup_dmabuf_cache : bs->dmabuf_cache;
+
 	if (info.plane_count == 0)
 		return;
 
@@ -397,72 +596,81 @@ void BrowserClient::OnAcceleratedPaint(CefRefPtr<CefBrowser>, PaintElementType t
 	if (format.gs_format == GS_UNKNOWN)
 		return;
 
-	uint32_t *strides = (uint32_t *)alloca(info.plane_count * sizeof(uint32_t));
-	uint32_t *offsets = (uint32_t *)alloca(info.plane_count * sizeof(uint32_t));
-	uint64_t *modifiers = (uint64_t *)alloca(info.plane_count * sizeof(uint64_t));
-	int *fds = (int *)alloca(info.plane_count * sizeof(int));
-
 	/* NOTE: This a workaround under X11 where the modifier is always invalid where it can mean "no modifier" in
 	 * Chromium's code. */
 	if (obs_get_nix_platform() == OBS_NIX_PLATFORM_X11_EGL && modifier == DRM_FORMAT_MOD_INVALID)
 		modifier = DRM_FORMAT_MOD_LINEAR;
 
-	for (size_t i = 0; i < kAcceleratedPaintMaxPlanes; i++) {
-		auto *plane = &info.planes[i];
+	DmabufFrame frame;
+	frame.cx = (uint32_t)info.extra.coded_size.width;
+	frame.cy = (uint32_t)info.extra.coded_size.height;
+	frame.drm_format = format.drm_format;
+	frame.gs_format = format.gs_format;
+	frame.modifier = modifier;
+	frame.use_modifier = modifier != DRM_FORMAT_MOD_INVALID;
+	frame.plane_count = std::min<uint32_t>((uint32_t)info.plane_count, DMABUF_MAX_PLANES);
 
-		strides[i] = plane->stride;
-		offsets[i] = plane->offset;
-		fds[i] = plane->fd;
+	for (uint32_t i = 0; i < frame.plane_count; i++) {
+		auto *plane = &info.planes[i];
 
-		modifiers[i] = modifier;
+		frame.strides[i] = plane->stride;
+		frame.offsets[i] = plane->offset;
+		frame.fds[i] = plane->fd;
 	}
 #endif
 
+#if defined(__APPLE__) || defined(_WIN32)
+	void *&last_handle = popup ? bs->last_popup_handle : bs->last_handle;
+#endif
+
 #if !defined(_WIN32) && CHROME_VERSION_BUILD < 6367
-	if (shared_handle == bs->last_handle)
+	if (shared_handle == last_handle)
 		return;
 #endif
 
 	obs_enter_graphics();
 
-	if (bs->texture) {
+	if (texture) {
 #ifdef _WIN32
-		//gs_texture_release_sync(bs->texture, 0);
+		//gs_texture_release_sync(texture, 0);
+#endif
+#if !defined(_WIN32) && !defined(__APPLE__)
+		if (!dmabuf_cache.Owns(texture))
 #endif
-		gs_texture_destroy(bs->texture);
-		bs->texture = nullptr;
+			ReleasePooledTexture(texture);
+		texture = nullptr;
 	}
 
 #if defined(__APPLE__) && CHROME_VERSION_BUILD > 6367
-	bs->texture = gs_texture_create_from_iosurface((IOSurfaceRef)(uintptr_t)info.shared_texture_io_surface);
+	texture = gs_texture_create_from_iosurface((IOSurfaceRef)(uintptr_t)info.shared_texture_io_surface);
 #elif defined(__APPLE__) && CHROME_VERSION_BUILD > 4183
-	bs->texture = gs_texture_create_from_iosurface((IOSurfaceRef)(uintptr_t)shared_handle);
+	texture = gs_texture_create_from_iosurface((IOSurfaceRef)(uintptr_t)shared_handle);
 #elif defined(_WIN32) && CHROME_VERSION_BUILD > 4183
-	bs->texture =
+	texture =
 #if CHROME_VERSION_BUILD >= 6367
 		gs_texture_open_nt_shared((uint32_t)(uintptr_t)info.shared_texture_handle);
 #else
 		gs_texture_open_nt_shared((uint32_t)(uintptr_t)shared_handle);
 #endif
-	//if (bs->texture)
-	//	gs_texture_acquire_sync(bs->texture, 1, INFINITE);
+	//if (texture)
+	//	gs_texture_acquire_sync(texture, 1, INFINITE);
 
 #elif defined(_WIN32)
-	bs->texture = gs_texture_open_shared((uint32_t)(uintptr_t)shared_handle);
+	texture = gs_texture_open_shared((uint32_t)(uintptr_t)shared_handle);
 #else
-	bs->texture = gs_texture_create_from_dmabuf(info.extra.coded_size.width, info.extra.coded_size.height,
-						    format.drm_format, format.gs_format, info.plane_count, fds, strides,
-						    offsets, modifier != DRM_FORMAT_MOD_INVALID ? modifiers : NULL);
+	/* Chromium cycles through a few buffers, imported once each */
+	texture = dmabuf_cache.Get(frame);
 #endif
-	UpdateExtraTexture();
+	if (!popup)
+		UpdateExtraTexture();
 	obs_leave_graphics();
 
 #if defined(__APPLE__) && CHROME_VERSION_BUILD >= 6367
-	bs->last_handle = info.shared_texture_io_surface;
+	last_handle = info.shared_texture_io_surface;
 #elif defined(_WIN32) && CHROME_VERSION_BUILD >= 6367
-	bs->last_handle = info.shared_texture_handle;
+	last_handle = info.shared_texture_handle;
 #elif defined(__APPLE__) || defined(_WIN32)
-	bs->last_handle = shared_handle;
+	last_handle = shared_handle;
 #endif
 }
 
@@ -470,13 +678,18 @@ void BrowserClient::OnAcceleratedPaint(CefRefPtr<CefBrowser>, PaintElementType t
 void BrowserClient::OnAcceleratedPaint2(CefRefPtr<CefBrowser>, PaintElementType type, const RectList &,
 					void *shared_handle, bool new_texture)
 {
-	if (type != PET_VIEW) {
-		// TODO Overlay texture on top of bs->texture
+	if (!valid()) {
 		return;
 	}
 
-	if (!valid()) {
-		return;
+	const bool popup = type == PET_POPUP;
+	gs_texture_t *&texture = popup ? bs->popup_texture : bs->texture;
+
+	if (!popup) {
+		/* the shared texture may have been updated in place */
+		bs->frame_generation++;
+		bs->FinishPageFrame();
+		bs->MarkPaint();
 	}
 
 	if (!new_texture) {
@@ -485,20 +698,21 @@ void BrowserClient::OnAcceleratedPaint2(CefRefPtr<CefBrowser>, PaintElementType
 
 	obs_enter_graphics();
 
-	if (bs->texture) {
-		gs_texture_destroy(bs->texture);
-		bs->texture = nullptr;
+	if (texture) {
+		ReleasePooledTexture(texture);
+		texture = nullptr;
 	}
 
 #if defined(__APPLE__) && CHROME_VERSION_BUILD > 4183
-	bs->texture = gs_texture_create_from_iosurface((IOSurfaceRef)(uintptr_t)shared_handle);
+	texture = gs_texture_create_from_iosurface((IOSurfaceRef)(uintptr_t)shared_handle);
 #elif defined(_WIN32) && CHROME_VERSION_BUILD > 4183
-	bs->texture = gs_texture_open_nt_shared((uint32_t)(uintptr_t)shared_handle);
+	texture = gs_texture_open_nt_shared((uint32_t)(uintptr_t)shared_handle);
 
 #else
-	bs->texture = gs_texture_open_shared((uint32_t)(uintptr_t)shared_handle);
+	texture = gs_texture_open_shared((uint32_t)(uintptr_t)shared_handle);
 #endif
-	UpdateExtraTexture();
+	if (!popup)
+		UpdateExtraTexture();
 	obs_leave_graphics();
 }
 #endif
@@ -683,12 +897,21 @@ void BrowserClient::OnAudioStreamStopped(CefRefPtr<CefBrowser> browser, int id)
 }
 #endif
 
+void BrowserClient::OnLoadStart(CefRefPtr<CefBrowser>, CefRefPtr<CefFrame> frame, TransitionType)
+{
+	if (valid() && frame->IsMain())
+		bs->ResetPageControl();
+}
+
 void BrowserClient::OnLoadEnd(CefRefPtr<CefBrowser>, CefRefPtr<CefFrame> frame, int)
 {
 	if (!valid()) {
 		return;
 	}
 
+	if (frame->IsMain())
+		bs->snapshot_load_ts = os_gettime_ns();
+
 	if (frame->IsMain() && bs->css.length()) {
 		std::string uriEncodedCSS = CefURIEncode(bs->css, false).ToString();
 
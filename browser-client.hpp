@@ -23,6 +23,11 @@
 #include "cef-headers.hpp"
 #include "obs-browser-source.hpp"
 
+#if !defined(_WIN32) && !defined(__APPLE__)
+#include "browser-shm.hpp"
+#include <memory>
+#endif
+
 struct BrowserSource;
 
 class BrowserClient : public CefClient,
@@ -40,6 +45,10 @@ class BrowserClient : public CefClient,
 	bool sharing_available = false;
 	bool reroute_audio = true;
 	ControlLevel webpage_control_level = DEFAULT_CONTROL_LEVEL;
+	bool opaque = false;
+	FrameTiles tiles;
+	AlphaBounds alpha_bounds;
+	std::vector<uint8_t> yuv_buffer;
 
 	inline bool valid() const;
 
@@ -50,6 +59,10 @@ public:
 	CefRect popupRect;
 	CefRect originalPopupRect;
 
+#if !defined(_WIN32) && !defined(__APPLE__)
+	std::unique_ptr<ShmFrameExport> frame_export;
+#endif
+
 #if CHROME_VERSION_BUILD >= 4103
 	int sample_rate;
 	int channels;
@@ -57,10 +70,11 @@ public:
 	int frames_per_buffer;
 #endif
 	inline BrowserClient(BrowserSource *bs_, bool sharing_avail, bool reroute_audio_,
-			     ControlLevel webpage_control_level_)
+			     ControlLevel webpage_control_level_, bool opaque_)
 		: sharing_available(sharing_avail),
 		  reroute_audio(reroute_audio_),
 		  webpage_control_level(webpage_control_level_),
+		  opaque(opaque_),
 		  bs(bs_)
 	{
 	}
@@ -122,6 +136,9 @@ public:
 
 	/* CefRenderHandler */
 	virtual void GetViewRect(CefRefPtr<CefBrowser> browser, CefRect &rect) override;
+	virtual bool GetScreenInfo(CefRefPtr<CefBrowser> browser, CefScreenInfo &screen_info) override;
+	virtual void OnPopupShow(CefRefPtr<CefBrowser> browser, bool show) override;
+	virtual void OnPopupSize(CefRefPtr<CefBrowser> browser, const CefRect &rect) override;
 	virtual void OnPaint(CefRefPtr<CefBrowser> browser, PaintElementType type, const RectList &dirtyRects,
 			     const void *buffer, int width, int height) override;
 #ifdef ENABLE_BROWSER_SHARED_TEXTURE
@@ -159,6 +176,8 @@ public:
 					  int frames_per_buffer) override;
 #endif
 	/* CefLoadHandler */
+	virtual void OnLoadStart(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
+				 TransitionType transition_type) override;
 	virtual void OnLoadEnd(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame, int httpStatusCode) override;
 
 	IMPLEMENT_REFCOUNTING(BrowserClient);
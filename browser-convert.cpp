@@ -0,0 +1,379 @@
+#include "browser-convert.hpp"
+#include "browser-frame-hash.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CONVERT_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CONVERT_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Fixed point BT.709 coefficients in B, G, R, A order.  Luma is scaled by
+ * 2^15, chroma by 2^17 as it is computed from the sum of a 2x2 block.  The
+ * luma coefficients sum up to the range (255 or 219 levels), the chroma
+ * ones to zero, so that grays map exactly.  The offsets include rounding. */
+struct YuvCoeffs {
+	int16_t y[4];
+	int32_t y_add;
+	int16_t u[4];
+	int16_t v[4];
+	int32_t uv_add;
+};
+
+#define LUMA_SHIFT 15
+#define CHROMA_SHIFT 17
+#define CHROMA_ADD ((128 << CHROMA_SHIFT) + (1 << (CHROMA_SHIFT - 1)))
+
+static const YuvCoeffs coeffs_full = {
+	{2366, 23436, 6966, 0}, 1 << (LUMA_SHIFT - 1), {16384, -12630, -3754, 0}, {-1502, -14882, 16384, 0},
+	CHROMA_ADD,
+};
+
+static const YuvCoeffs coeffs_limited = {
+	{2032, 20127, 5983, 0}, (16 << LUMA_SHIFT) + (1 << (LUMA_SHIFT - 1)), {14392, -11094, -3298, 0},
+	{-1320, -13072, 14392, 0}, CHROMA_ADD,
+};
+
+static inline uint8_t Clamp8(int32_t val)
+{
+	return (uint8_t)(val < 0 ? 0 : val > 255 ? 255 : val);
+}
+
+/* ------------------------------------------------------------------------- */
+/* scalar, also used for the row tails of the vector kernels */
+
+static void LumaRowScalar(const uint8_t *src, uint8_t *dst, uint32_t x, uint32_t cx, const YuvCoeffs &c)
+{
+	for (; x < cx; x++) {
+		const uint8_t *p = src + (size_t)x * 4;
+		dst[x] = Clamp8((p[0] * c.y[0] + p[1] * c.y[1] + p[2] * c.y[2] + c.y_add) >> LUMA_SHIFT);
+	}
+}
+
+static void ChromaRowScalar(const uint8_t *row0, const uint8_t *row1, uint32_t block, uint32_t cx, uint8_t *u,
+			    uint8_t *v, uint32_t step, const YuvCoeffs &c)
+{
+	const uint32_t blocks = (cx + 1) / 2;
+
+	for (; block < blocks; block++) {
+		const size_t x0 = (size_t)block * 2 * 4;
+		const size_t x1 = block * 2 + 1 < cx ? x0 + 4 : x0;
+		int32_t sum[3];
+
+		for (int i = 0; i < 3; i++)
+			sum[i] = row0[x0 + i] + row0[x1 + i] + row1[x0 + i] + row1[x1 + i];
+
+		u[block * step] =
+			Clamp8((sum[0] * c.u[0] + sum[1] * c.u[1] + sum[2] * c.u[2] + c.uv_add) >> CHROMA_SHIFT);
+		v[block * step] =
+			Clamp8((sum[0] * c.v[0] + sum[1] * c.v[1] + sum[2] * c.v[2] + c.uv_add) >> CHROMA_SHIFT);
+	}
+}
+
+static void LumaRowC(const uint8_t *src, uint8_t *dst, uint32_t cx, const YuvCoeffs &c)
+{
+	LumaRowScalar(src, dst, 0, cx, c);
+}
+
+static void ChromaRowC(const uint8_t *row0, const uint8_t *row1, uint32_t cx, uint8_t *u, uint8_t *v, uint32_t step,
+		       const YuvCoeffs &c)
+{
+	ChromaRowScalar(row0, row1, 0, cx, u, v, step, c);
+}
+
+/* ------------------------------------------------------------------------- */
+
+#ifdef CONVERT_X86
+/* dot products of two pixels' (or blocks') 16 bit BGRA with the
+ * coefficients end up in the even 32 bit lanes */
+static inline __m128i DotPairsSSE2(__m128i px, __m128i coeff)
+{
+	const __m128i prod = _mm_madd_epi16(px, coeff);
+	return _mm_add_epi32(prod, _mm_srli_epi64(prod, 32));
+}
+
+static inline __m128i EvenLanes(__m128i a, __m128i b)
+{
+	return _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+static inline __m128i Luma4SSE2(const uint8_t *src, __m128i coeff, __m128i add)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i px = _mm_loadu_si128((const __m128i *)src);
+	const __m128i lo = DotPairsSSE2(_mm_unpacklo_epi8(px, zero), coeff);
+	const __m128i hi = DotPairsSSE2(_mm_unpackhi_epi8(px, zero), coeff);
+	return _mm_srai_epi32(_mm_add_epi32(EvenLanes(lo, hi), add), LUMA_SHIFT);
+}
+
+static inline __m128i LoadCoeffs(const int16_t k[4])
+{
+	return _mm_set_epi16(k[3], k[2], k[1], k[0], k[3], k[2], k[1], k[0]);
+}
+
+static void LumaRowSSE2(const uint8_t *src, uint8_t *dst, uint32_t cx, const YuvCoeffs &c)
+{
+	const __m128i coeff = LoadCoeffs(c.y);
+	const __m128i add = _mm_set1_epi32(c.y_add);
+	uint32_t x = 0;
+
+	for (; x + 16 <= cx; x += 16) {
+		const uint8_t *p = src + (size_t)x * 4;
+		const __m128i y0 = Luma4SSE2(p, coeff, add);
+		const __m128i y1 = Luma4SSE2(p + 16, coeff, add);
+		const __m128i y2 = Luma4SSE2(p + 32, coeff, add);
+		const __m128i y3 = Luma4SSE2(p + 48, coeff, add);
+		const __m128i out = _mm_packus_epi16(_mm_packs_epi32(y0, y1), _mm_packs_epi32(y2, y3));
+		_mm_storeu_si128((__m128i *)(dst + x), out);
+	}
+
+	LumaRowScalar(src, dst, x, cx, c);
+}
+
+/* BGRA sums of two 2x2 blocks, as 16 bit */
+static inline __m128i BlockSums2SSE2(const uint8_t *p0, const uint8_t *p1)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i a = _mm_loadu_si128((const __m128i *)p0);
+	const __m128i b = _mm_loadu_si128((const __m128i *)p1);
+	const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+	const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+	return _mm_unpacklo_epi64(_mm_add_epi16(lo, _mm_srli_si128(lo, 8)), _mm_add_epi16(hi, _mm_srli_si128(hi, 8)));
+}
+
+static void ChromaRowSSE2(const uint8_t *row0, const uint8_t *row1, uint32_t cx, uint8_t *u, uint8_t *v,
+			  uint32_t step, const YuvCoeffs &c)
+{
+	const __m128i u_coeff = LoadCoeffs(c.u);
+	const __m128i v_coeff = LoadCoeffs(c.v);
+	const __m128i add = _mm_set1_epi32(c.uv_add);
+	uint32_t block = 0;
+
+	for (; block * 2 + 8 <= cx; block += 4) {
+		const size_t offset = (size_t)block * 2 * 4;
+		const __m128i s0 = BlockSums2SSE2(row0 + offset, row1 + offset);
+		const __m128i s1 = BlockSums2SSE2(row0 + offset + 16, row1 + offset + 16);
+
+		__m128i u4 = EvenLanes(DotPairsSSE2(s0, u_coeff), DotPairsSSE2(s1, u_coeff));
+		__m128i v4 = EvenLanes(DotPairsSSE2(s0, v_coeff), DotPairsSSE2(s1, v_coeff));
+		u4 = _mm_srai_epi32(_mm_add_epi32(u4, add), CHROMA_SHIFT);
+		v4 = _mm_srai_epi32(_mm_add_epi32(v4, add), CHROMA_SHIFT);
+
+		/* u0..u3 v0..v3 */
+		const __m128i uv = _mm_packus_epi16(_mm_packs_epi32(u4, v4), _mm_setzero_si128());
+
+		if (step == 2) {
+			_mm_storel_epi64((__m128i *)(u + block * 2), _mm_unpacklo_epi8(uv, _mm_srli_si128(uv, 4)));
+		} else {
+			const int32_t u_bytes = _mm_cvtsi128_si32(uv);
+			const int32_t v_bytes = _mm_cvtsi128_si32(_mm_srli_si128(uv, 4));
+			memcpy(u + block, &u_bytes, 4);
+			memcpy(v + block, &v_bytes, 4);
+		}
+	}
+
+	ChromaRowScalar(row0, row1, block, cx, u, v, step, c);
+}
+
+#ifndef _MSC_VER
+__attribute__((target("avx2")))
+#endif
+static void LumaRowAVX2(const uint8_t *src, uint8_t *dst, uint32_t cx, const YuvCoeffs &c)
+{
+	const __m256i coeff = _mm256_set_epi16(c.y[3], c.y[2], c.y[1], c.y[0], c.y[3], c.y[2], c.y[1], c.y[0],
+					       c.y[3], c.y[2], c.y[1], c.y[0], c.y[3], c.y[2], c.y[1], c.y[0]);
+	const __m256i add = _mm256_set1_epi32(c.y_add);
+	const __m256i zero = _mm256_setzero_si256();
+	/* undoes the per-lane interleaving of the packs */
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	uint32_t x = 0;
+
+	for (; x + 32 <= cx; x += 32) {
+		__m256i sums[4];
+
+		for (int i = 0; i < 4; i++) {
+			const __m256i px = _mm256_loadu_si256((const __m256i *)(src + ((size_t)x + i * 8) * 4));
+			__m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), coeff);
+			__m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), coeff);
+			lo = _mm256_add_epi32(lo, _mm256_srli_epi64(lo, 32));
+			hi = _mm256_add_epi32(hi, _mm256_srli_epi64(hi, 32));
+
+			/* pixels 0-3 in the low lane, 4-7 in the high one */
+			const __m256i even = _mm256_castps_si256(_mm256_shuffle_ps(
+				_mm256_castsi256_ps(lo), _mm256_castsi256_ps(hi), _MM_SHUFFLE(2, 0, 2, 0)));
+			sums[i] = _mm256_srai_epi32(_mm256_add_epi32(even, add), LUMA_SHIFT);
+		}
+
+		const __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(sums[0], sums[1]),
+							   _mm256_packs_epi32(sums[2], sums[3]));
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_permutevar8x32_epi32(packed, order));
+	}
+
+	LumaRowScalar(src, dst, x, cx, c);
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+#ifdef CONVERT_NEON
+static inline int32x4_t DotNEON(int16x4_t b, int16x4_t g, int16x4_t r, const int16_t k[4], int32_t add)
+{
+	int32x4_t acc = vmlal_n_s16(vdupq_n_s32(add), b, k[0]);
+	acc = vmlal_n_s16(acc, g, k[1]);
+	return vmlal_n_s16(acc, r, k[2]);
+}
+
+static inline uint8x8_t Narrow8NEON(int32x4_t lo, int32x4_t hi)
+{
+	return vqmovn_u16(vcombine_u16(vqmovun_s32(lo), vqmovun_s32(hi)));
+}
+
+static void LumaRowNEON(const uint8_t *src, uint8_t *dst, uint32_t cx, const YuvCoeffs &c)
+{
+	uint32_t x = 0;
+
+	for (; x + 16 <= cx; x += 16) {
+		const uint8x16x4_t px = vld4q_u8(src + (size_t)x * 4);
+		uint8x8_t out[2];
+
+		for (int i = 0; i < 2; i++) {
+			const uint8x8_t b8 = i ? vget_high_u8(px.val[0]) : vget_low_u8(px.val[0]);
+			const uint8x8_t g8 = i ? vget_high_u8(px.val[1]) : vget_low_u8(px.val[1]);
+			const uint8x8_t r8 = i ? vget_high_u8(px.val[2]) : vget_low_u8(px.val[2]);
+			const int16x8_t b = vreinterpretq_s16_u16(vmovl_u8(b8));
+			const int16x8_t g = vreinterpretq_s16_u16(vmovl_u8(g8));
+			const int16x8_t r = vreinterpretq_s16_u16(vmovl_u8(r8));
+
+			const int32x4_t lo = DotNEON(vget_low_s16(b), vget_low_s16(g), vget_low_s16(r), c.y, c.y_add);
+			const int32x4_t hi =
+				DotNEON(vget_high_s16(b), vget_high_s16(g), vget_high_s16(r), c.y, c.y_add);
+			out[i] = Narrow8NEON(vshrq_n_s32(lo, LUMA_SHIFT), vshrq_n_s32(hi, LUMA_SHIFT));
+		}
+
+		vst1q_u8(dst + x, vcombine_u8(out[0], out[1]));
+	}
+
+	LumaRowScalar(src, dst, x, cx, c);
+}
+
+static void ChromaRowNEON(const uint8_t *row0, const uint8_t *row1, uint32_t cx, uint8_t *u, uint8_t *v,
+			  uint32_t step, const YuvCoeffs &c)
+{
+	uint32_t block = 0;
+
+	for (; block * 2 + 16 <= cx; block += 8) {
+		const size_t offset = (size_t)block * 2 * 4;
+		const uint8x16x4_t p0 = vld4q_u8(row0 + offset);
+		const uint8x16x4_t p1 = vld4q_u8(row1 + offset);
+
+		/* pairwise adds give the horizontal sums, one per block */
+		const int16x8_t b = vreinterpretq_s16_u16(vaddq_u16(vpaddlq_u8(p0.val[0]), vpaddlq_u8(p1.val[0])));
+		const int16x8_t g = vreinterpretq_s16_u16(vaddq_u16(vpaddlq_u8(p0.val[1]), vpaddlq_u8(p1.val[1])));
+		const int16x8_t r = vreinterpretq_s16_u16(vaddq_u16(vpaddlq_u8(p0.val[2]), vpaddlq_u8(p1.val[2])));
+
+		const int32x4_t u_lo = DotNEON(vget_low_s16(b), vget_low_s16(g), vget_low_s16(r), c.u, c.uv_add);
+		const int32x4_t u_hi = DotNEON(vget_high_s16(b), vget_high_s16(g), vget_high_s16(r), c.u, c.uv_add);
+		const int32x4_t v_lo = DotNEON(vget_low_s16(b), vget_low_s16(g), vget_low_s16(r), c.v, c.uv_add);
+		const int32x4_t v_hi = DotNEON(vget_high_s16(b), vget_high_s16(g), vget_high_s16(r), c.v, c.uv_add);
+
+		uint8x8x2_t uv;
+		uv.val[0] = Narrow8NEON(vshrq_n_s32(u_lo, CHROMA_SHIFT), vshrq_n_s32(u_hi, CHROMA_SHIFT));
+		uv.val[1] = Narrow8NEON(vshrq_n_s32(v_lo, CHROMA_SHIFT), vshrq_n_s32(v_hi, CHROMA_SHIFT));
+
+		if (step == 2) {
+			vst2_u8(u + block * 2, uv);
+		} else {
+			vst1_u8(u + block, uv.val[0]);
+			vst1_u8(v + block, uv.val[1]);
+		}
+	}
+
+	ChromaRowScalar(row0, row1, block, cx, u, v, step, c);
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+typedef void (*luma_row_t)(const uint8_t *src, uint8_t *dst, uint32_t cx, const YuvCoeffs &c);
+typedef void (*chroma_row_t)(const uint8_t *row0, const uint8_t *row1, uint32_t cx, uint8_t *u, uint8_t *v,
+			     uint32_t step, const YuvCoeffs &c);
+
+struct ConvertKernels {
+	luma_row_t luma;
+	chroma_row_t chroma;
+};
+
+static ConvertKernels GetKernels(ConvertKernel kernel)
+{
+	switch (kernel) {
+	case ConvertKernel::Scalar:
+		return {LumaRowC, ChromaRowC};
+#if defined(CONVERT_X86)
+	/* chroma is a third of the work, SSE2 is good enough for it */
+	case ConvertKernel::SSE2:
+		return {LumaRowSSE2, ChromaRowSSE2};
+	case ConvertKernel::AVX2:
+		if (CpuHasAVX2())
+			return {LumaRowAVX2, ChromaRowSSE2};
+		return {nullptr, nullptr};
+	case ConvertKernel::Auto:
+		if (CpuHasAVX2())
+			return {LumaRowAVX2, ChromaRowSSE2};
+		return {LumaRowSSE2, ChromaRowSSE2};
+#elif defined(CONVERT_NEON)
+	case ConvertKernel::NEON:
+	case ConvertKernel::Auto:
+		return {LumaRowNEON, ChromaRowNEON};
+#else
+	case ConvertKernel::Auto:
+		return {LumaRowC, ChromaRowC};
+#endif
+	default:
+		return {nullptr, nullptr};
+	}
+}
+
+bool ConvertKernelSupported(ConvertKernel kernel)
+{
+	return GetKernels(kernel).luma != nullptr;
+}
+
+static void ConvertBGRA(const uint8_t *src, uint32_t linesize, uint32_t cx, uint32_t cy, uint8_t *y_plane,
+			uint32_t y_linesize, uint8_t *u, uint32_t u_linesize, uint8_t *v, uint32_t v_linesize,
+			uint32_t step, bool full_range, ConvertKernel kernel)
+{
+	static const ConvertKernels auto_kernels = GetKernels(ConvertKernel::Auto);
+	const ConvertKernels kernels = kernel == ConvertKernel::Auto ? auto_kernels : GetKernels(kernel);
+	const YuvCoeffs &c = full_range ? coeffs_full : coeffs_limited;
+
+	for (uint32_t y = 0; y < cy; y += 2) {
+		const uint8_t *row0 = src + (size_t)y * linesize;
+		const uint8_t *row1 = y + 1 < cy ? row0 + linesize : row0;
+
+		kernels.luma(row0, y_plane + (size_t)y * y_linesize, cx, c);
+		if (y + 1 < cy)
+			kernels.luma(row1, y_plane + (size_t)(y + 1) * y_linesize, cx, c);
+
+		const size_t uv_row = y / 2;
+		kernels.chroma(row0, row1, cx, u + uv_row * u_linesize, v + uv_row * v_linesize, step, c);
+	}
+}
+
+void ConvertBGRAToNV12(const uint8_t *src, uint32_t linesize, uint32_t cx, uint32_t cy, uint8_t *y_plane,
+		       uint32_t y_linesize, uint8_t *uv_plane, uint32_t uv_linesize, bool full_range,
+		       ConvertKernel kernel)
+{
+	ConvertBGRA(src, linesize, cx, cy, y_plane, y_linesize, uv_plane, uv_linesize, uv_plane + 1, uv_linesize, 2,
+		    full_range, kernel);
+}
+
+void ConvertBGRAToI420(const uint8_t *src, uint32_t linesize, uint32_t cx, uint32_t cy, uint8_t *y_plane,
+		       uint32_t y_linesize, uint8_t *u_plane, uint32_t u_linesize, uint8_t *v_plane,
+		       uint32_t v_linesize, bool full_range, ConvertKernel kernel)
+{
+	ConvertBGRA(src, linesize, cx, cy, y_plane, y_linesize, u_plane, u_linesize, v_plane, v_linesize, 1,
+		    full_range, kernel);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+/* BGRA to BT.709 YUV 4:2:0 conversion for opaque frames; the alpha channel
+ * is ignored.  Chroma is the average of each 2x2 block, odd edges repeat
+ * the last column/row.  An AVX2, SSE2, NEON or scalar kernel is picked at
+ * runtime unless one is given; all of them return the same bytes for the
+ * same input. */
+
+enum class ConvertKernel {
+	Auto,
+	Scalar,
+	SSE2,
+	AVX2,
+	NEON,
+};
+
+/* Whether a kernel is built in and supported by the CPU */
+bool ConvertKernelSupported(ConvertKernel kernel);
+
+/* A kernel other than Auto must be supported */
+void ConvertBGRAToNV12(const uint8_t *src, uint32_t linesize, uint32_t cx, uint32_t cy, uint8_t *y_plane,
+		       uint32_t y_linesize, uint8_t *uv_plane, uint32_t uv_linesize, bool full_range,
+		       ConvertKernel kernel = ConvertKernel::Auto);
+
+void ConvertBGRAToI420(const uint8_t *src, uint32_t linesize, uint32_t cx, uint32_t cy, uint8_t *y_plane,
+		       uint32_t y_linesize, uint8_t *u_plane, uint32_t u_linesize, uint8_t *v_plane,
+		       uint32_t v_linesize, bool full_range, ConvertKernel kernel = ConvertKernel::Auto);
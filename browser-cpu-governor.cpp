@@ -0,0 +1,294 @@
+#include "browser-cpu-governor.hpp"
+#include "obs-browser-source.hpp"
+
+#include <util/platform.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+bool ReadProcessCpuTime(int pid, uint64_t &cpu_ns)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return false;
+
+	char buf[1024];
+	const size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[len] = 0;
+
+	/* the command name may contain spaces and parentheses itself */
+	const char *fields = strrchr(buf, ')');
+	if (!fields)
+		return false;
+
+	/* state, ppid, pgrp, session, tty_nr, tpgid, flags, minflt, cminflt,
+	 * majflt, cmajflt, then utime and stime in clock ticks */
+	unsigned long utime, stime;
+	if (sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+		return false;
+
+	static const long ticks = sysconf(_SC_CLK_TCK);
+	cpu_ns = (uint64_t)(utime + stime) * 1000000000ULL / (uint64_t)ticks;
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct CpuGovernorDecision {
+	uint64_t ts = 0;
+	std::string source;
+	double from = 0.0;
+	double to = 0.0;
+	double usage = 0.0;
+	double total = 0.0;
+};
+
+static std::atomic<int> budget = 0;
+
+static std::mutex governor_mutex;
+static std::condition_variable governor_cv;
+static std::thread governor_thread;
+static bool governor_stop = false;
+
+/* governor thread only */
+static std::map<int, uint64_t> prev_cpu_ns;
+static uint64_t prev_sample_ts = 0;
+
+/* guarded by governor_mutex */
+static std::vector<CpuGovernorSource> last_sources;
+static double last_total = 0.0;
+static std::deque<CpuGovernorDecision> decisions;
+
+static void RecordDecision(const CpuGovernorSource &source, double from, double to, double total)
+{
+	const int percent = budget;
+
+	if (to == 0.0)
+		blog(LOG_INFO,
+		     "[obs-browser]: CPU governor: '%s' back to full rate from %.1f fps "
+		     "(%.0f%% CPU, total %.0f%% of %d%%)",
+		     source.name.c_str(), from, source.usage * 100.0, total * 100.0, percent);
+	else
+		blog(LOG_INFO,
+		     "[obs-browser]: CPU governor: '%s' limited from %.1f to %.1f fps "
+		     "(%.0f%% CPU, total %.0f%% of %d%%)",
+		     source.name.c_str(), from, to, source.usage * 100.0, total * 100.0, percent);
+
+	CpuGovernorDecision decision;
+	decision.ts = os_gettime_ns();
+	decision.source = source.name;
+	decision.from = from;
+	decision.to = to;
+	decision.usage = source.usage;
+	decision.total = total;
+
+	std::lock_guard<std::mutex> lock(governor_mutex);
+	decisions.push_back(std::move(decision));
+	if (decisions.size() > CPU_GOVERNOR_MAX_DECISIONS)
+		decisions.pop_front();
+}
+
+static void SetLimit(CpuGovernorSource &source, double limit, double total)
+{
+	const double from = source.limit > 0.0 ? source.limit : source.frame_rate;
+	source.limit = limit;
+	RecordDecision(source, from, limit, total);
+}
+
+/* CPU time is taken to scale with the frame rate: when over the budget,
+ * sources are halved, lowest priority and most expensive first, until the
+ * estimated savings cover the excess.  Below the headroom, one lowered
+ * source per interval gets its rate doubled, in the reverse order, if the
+ * estimated cost still fits. */
+static void Govern(std::vector<CpuGovernorSource> &sources, double total)
+{
+	const double limit = budget / 100.0;
+
+	for (CpuGovernorSource &source : sources) {
+		if (source.limit > 0.0 && (limit <= 0.0 || source.program))
+			SetLimit(source, 0.0, total);
+	}
+
+	if (limit <= 0.0)
+		return;
+
+	std::vector<CpuGovernorSource *> order;
+	for (CpuGovernorSource &source : sources) {
+		if (!source.program)
+			order.push_back(&source);
+	}
+
+	std::sort(order.begin(), order.end(), [](const CpuGovernorSource *a, const CpuGovernorSource *b) {
+		if (a->priority != b->priority)
+			return a->priority < b->priority;
+		return a->usage > b->usage;
+	});
+
+	if (total > limit) {
+		double excess = total - limit;
+
+		for (CpuGovernorSource *source : order) {
+			if (excess <= 0.0)
+				break;
+
+			const double rate = source->frame_rate;
+			if (source->usage <= 0.0 || rate <= CPU_GOVERNOR_MIN_FPS)
+				continue;
+
+			const double lowered = std::max(CPU_GOVERNOR_MIN_FPS, rate / 2.0);
+			excess -= source->usage * (1.0 - lowered / rate);
+			SetLimit(*source, lowered, total);
+		}
+
+	} else if (total < limit * CPU_GOVERNOR_HEADROOM) {
+		for (auto it = order.rbegin(); it != order.rend(); ++it) {
+			CpuGovernorSource *source = *it;
+			if (source->limit <= 0.0)
+				continue;
+
+			const double raised = source->limit * 2.0;
+			const double rate = std::max(source->frame_rate, CPU_GOVERNOR_MIN_FPS);
+			const double cost = source->usage * (raised / rate - 1.0);
+			if (total + cost > limit * CPU_GOVERNOR_HEADROOM)
+				break;
+
+			SetLimit(*source, raised >= source->max_frame_rate ? 0.0 : raised, total);
+			break;
+		}
+	}
+}
+
+static void RunCpuGovernor()
+{
+	std::vector<CpuGovernorSource> sources;
+	CollectCpuGovernorSources(sources);
+
+	const uint64_t now = os_gettime_ns();
+
+	/* renderers can be shared by several sources, which split its time */
+	std::map<int, uint64_t> cpu_ns;
+	std::map<int, int> shares;
+	for (const CpuGovernorSource &source : sources) {
+		if (!source.pid)
+			continue;
+
+		uint64_t ns;
+		if (!cpu_ns.count(source.pid) && ReadProcessCpuTime(source.pid, ns))
+			cpu_ns[source.pid] = ns;
+		shares[source.pid]++;
+	}
+
+	double total = 0.0;
+	for (CpuGovernorSource &source : sources) {
+		auto cur = cpu_ns.find(source.pid);
+		auto prev = prev_cpu_ns.find(source.pid);
+		if (cur == cpu_ns.end() || prev == prev_cpu_ns.end() || cur->second < prev->second)
+			continue;
+
+		source.usage = (double)(cur->second - prev->second) / (double)(now - prev_sample_ts) /
+			       shares[source.pid];
+		total += source.usage;
+	}
+
+	prev_cpu_ns = std::move(cpu_ns);
+	prev_sample_ts = now;
+
+	Govern(sources, total);
+	ApplyCpuGovernorLimits(sources);
+
+	std::lock_guard<std::mutex> lock(governor_mutex);
+	last_sources = std::move(sources);
+	last_total = total;
+}
+
+static void CpuGovernorThread()
+{
+	os_set_thread_name("obs-browser: CPU governor");
+
+	std::unique_lock<std::mutex> lock(governor_mutex);
+
+	while (!governor_stop) {
+		governor_cv.wait_for(lock, std::chrono::milliseconds(CPU_GOVERNOR_INTERVAL_MS));
+		if (governor_stop)
+			break;
+
+		lock.unlock();
+		RunCpuGovernor();
+		lock.lock();
+	}
+}
+
+void SetCpuGovernor(obs_data_t *data)
+{
+	if (obs_data_has_user_value(data, "budget"))
+		budget = std::max((int)obs_data_get_int(data, "budget"), 0);
+}
+
+void GetCpuGovernor(obs_data_t *data)
+{
+	obs_data_set_int(data, "budget", budget);
+
+	std::lock_guard<std::mutex> lock(governor_mutex);
+
+	obs_data_set_double(data, "usage", last_total * 100.0);
+
+	OBSDataArrayAutoRelease sources = obs_data_array_create();
+	for (const CpuGovernorSource &source : last_sources) {
+		OBSDataAutoRelease item = obs_data_create();
+		obs_data_set_string(item, "source_name", source.name.c_str());
+		obs_data_set_int(item, "pid", source.pid);
+		obs_data_set_int(item, "priority", (int)source.priority);
+		obs_data_set_bool(item, "program", source.program);
+		obs_data_set_double(item, "usage", source.usage * 100.0);
+		obs_data_set_double(item, "frame_rate", source.frame_rate);
+		obs_data_set_double(item, "limit", source.limit);
+		obs_data_array_push_back(sources, item);
+	}
+	obs_data_set_array(data, "sources", sources);
+
+	OBSDataArrayAutoRelease history = obs_data_array_create();
+	for (const CpuGovernorDecision &decision : decisions) {
+		OBSDataAutoRelease item = obs_data_create();
+		obs_data_set_int(item, "timestamp", (long long)decision.ts);
+		obs_data_set_string(item, "source_name", decision.source.c_str());
+		obs_data_set_double(item, "from", decision.from);
+		obs_data_set_double(item, "to", decision.to);
+		obs_data_set_double(item, "usage", decision.usage * 100.0);
+		obs_data_set_double(item, "total", decision.total * 100.0);
+		obs_data_array_push_back(history, item);
+	}
+	obs_data_set_array(data, "decisions", history);
+}
+
+void StartCpuGovernor()
+{
+	std::lock_guard<std::mutex> lock(governor_mutex);
+
+	governor_stop = false;
+	if (!governor_thread.joinable())
+		governor_thread = std::thread(CpuGovernorThread);
+}
+
+void StopCpuGovernor()
+{
+	{
+		std::lock_guard<std::mutex> lock(governor_mutex);
+		governor_stop = true;
+		governor_cv.notify_all();
+	}
+
+	if (governor_thread.joinable())
+		governor_thread.join();
+}
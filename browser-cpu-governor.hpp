@@ -0,0 +1,53 @@
+#pragma once
+
+#include <obs-module.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* How often renderer CPU time is sampled and frame rates adjusted */
+#define CPU_GOVERNOR_INTERVAL_MS 1000
+
+/* Number of decisions kept for get_cpu_governor */
+#define CPU_GOVERNOR_MAX_DECISIONS 32
+
+/* Frame rate sources are never lowered below */
+#define CPU_GOVERNOR_MIN_FPS 1.0
+
+/* Share of the budget below which lowered sources are raised again */
+#define CPU_GOVERNOR_HEADROOM 0.8
+
+/* Order in which sources are lowered when over the budget, low first */
+enum class CpuPriority : int {
+	Low,
+	Normal,
+	High,
+};
+
+/* A browser source as seen by the governor.  usage is the share of a core
+ * its renderer used over the last interval, and limit the frame rate the
+ * governor holds it to, 0 for none. */
+struct CpuGovernorSource {
+	const void *id = nullptr;
+	std::string name;
+	int pid = 0;
+	CpuPriority priority = CpuPriority::Normal;
+	bool program = false;
+	double frame_rate = 0.0;
+	double max_frame_rate = 0.0;
+	double limit = 0.0;
+	double usage = 0.0;
+};
+
+/* Returns false if the process is gone */
+bool ReadProcessCpuTime(int pid, uint64_t &cpu_ns);
+
+/* Budget in percent of one core, 0 to disable the governor.  Set takes the
+ * budget field if it is present. */
+void SetCpuGovernor(obs_data_t *data);
+void GetCpuGovernor(obs_data_t *data);
+
+/* Samples and adjusts the sources every CPU_GOVERNOR_INTERVAL_MS, from a
+ * thread of its own */
+void StartCpuGovernor();
+void StopCpuGovernor();
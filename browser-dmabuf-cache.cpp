@@ -0,0 +1,139 @@
+#include "browser-dmabuf-cache.hpp"
+
+#include <cstring>
+#include <sys/stat.h>
+
+bool DmabufKey::operator==(const DmabufKey &other) const
+{
+	return plane_count == other.plane_count && drm_format == other.drm_format && modifier == other.modifier &&
+	       cx == other.cx && cy == other.cy && memcmp(dev, other.dev, sizeof(dev)) == 0 &&
+	       memcmp(ino, other.ino, sizeof(ino)) == 0 && memcmp(strides, other.strides, sizeof(strides)) == 0 &&
+	       memcmp(offsets, other.offsets, sizeof(offsets)) == 0;
+}
+
+bool GetDmabufKey(const DmabufFrame &frame, DmabufKey &key)
+{
+	if (frame.plane_count > DMABUF_MAX_PLANES)
+		return false;
+
+	key = DmabufKey();
+	key.plane_count = frame.plane_count;
+	key.drm_format = frame.drm_format;
+	key.modifier = frame.use_modifier ? frame.modifier : 0;
+	key.cx = frame.cx;
+	key.cy = frame.cy;
+
+	for (uint32_t i = 0; i < frame.plane_count; i++) {
+		struct stat st;
+		if (fstat(frame.fds[i], &st) != 0)
+			return false;
+
+		key.dev[i] = (uint64_t)st.st_dev;
+		key.ino[i] = (uint64_t)st.st_ino;
+		key.strides[i] = frame.strides[i];
+		key.offsets[i] = frame.offsets[i];
+	}
+
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+class GraphicsDmabufImporter : public DmabufImporter {
+public:
+	gs_texture_t *Import(const DmabufFrame &frame) override
+	{
+		uint64_t modifiers[DMABUF_MAX_PLANES];
+		for (uint64_t &modifier : modifiers)
+			modifier = frame.modifier;
+
+		return gs_texture_create_from_dmabuf(frame.cx, frame.cy, frame.drm_format, frame.gs_format,
+						     frame.plane_count, frame.fds, frame.strides, frame.offsets,
+						     frame.use_modifier ? modifiers : nullptr);
+	}
+
+	void Destroy(gs_texture_t *tex) override { gs_texture_destroy(tex); }
+};
+
+DmabufTextureCache::DmabufTextureCache(std::unique_ptr<DmabufImporter> importer_) : importer(std::move(importer_))
+{
+	if (!importer)
+		importer = std::make_unique<GraphicsDmabufImporter>();
+}
+
+DmabufTextureCache::~DmabufTextureCache()
+{
+	Clear();
+}
+
+void DmabufTextureCache::Evict(size_t idx)
+{
+	importer->Destroy(entries[idx].tex);
+	entries.erase(entries.begin() + idx);
+	evictions++;
+}
+
+gs_texture_t *DmabufTextureCache::Get(const DmabufFrame &frame)
+{
+	DmabufKey key;
+	const bool keyed = GetDmabufKey(frame, key);
+
+	/* after a resize or format change, none of the old buffers come back */
+	for (size_t i = entries.size(); i > 0; i--) {
+		const Entry &entry = entries[i - 1];
+		if (!entry.keyed || entry.key.cx != frame.cx || entry.key.cy != frame.cy ||
+		    entry.key.drm_format != frame.drm_format || entry.key.modifier != key.modifier)
+			Evict(i - 1);
+	}
+
+	if (keyed) {
+		for (Entry &entry : entries) {
+			if (entry.key == key) {
+				entry.last_used = ++use_count;
+				hits++;
+				return entry.tex;
+			}
+		}
+	}
+
+	if (entries.size() == DMABUF_CACHE_SIZE) {
+		size_t oldest = 0;
+		for (size_t i = 1; i < entries.size(); i++) {
+			if (entries[i].last_used < entries[oldest].last_used)
+				oldest = i;
+		}
+		Evict(oldest);
+	}
+
+	gs_texture_t *tex = importer->Import(frame);
+	if (!tex)
+		return nullptr;
+
+	imports++;
+
+	/* a buffer that could not be identified is only kept until the next
+	 * frame replaces it */
+	Entry entry;
+	entry.key = key;
+	entry.keyed = keyed;
+	entry.tex = tex;
+	entry.last_used = ++use_count;
+	entries.push_back(entry);
+	return tex;
+}
+
+bool DmabufTextureCache::Owns(gs_texture_t *tex) const
+{
+	for (const Entry &entry : entries) {
+		if (entry.tex == tex)
+			return true;
+	}
+	return false;
+}
+
+void DmabufTextureCache::Clear()
+{
+	for (const Entry &entry : entries)
+		importer->Destroy(entry.tex);
+	entries.clear();
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <graphics/graphics.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#define DMABUF_MAX_PLANES 4
+
+/* Number of imported buffers kept, enough for the handful Chromium cycles
+ * through */
+#define DMABUF_CACHE_SIZE 6
+
+/* A frame shared by Chromium as dmabuf planes */
+struct DmabufFrame {
+	uint32_t cx = 0;
+	uint32_t cy = 0;
+	uint32_t drm_format = 0;
+	enum gs_color_format gs_format = GS_UNKNOWN;
+	uint64_t modifier = 0;
+	bool use_modifier = false;
+	uint32_t plane_count = 0;
+	int fds[DMABUF_MAX_PLANES] = {-1, -1, -1, -1};
+	uint32_t strides[DMABUF_MAX_PLANES] = {};
+	uint32_t offsets[DMABUF_MAX_PLANES] = {};
+};
+
+/* Identity of the buffers behind a frame.  Chromium sends new fds with every
+ * frame, but they refer to the same few buffers, which fstat tells apart. */
+struct DmabufKey {
+	uint64_t dev[DMABUF_MAX_PLANES] = {};
+	uint64_t ino[DMABUF_MAX_PLANES] = {};
+	uint32_t strides[DMABUF_MAX_PLANES] = {};
+	uint32_t offsets[DMABUF_MAX_PLANES] = {};
+	uint32_t plane_count = 0;
+	uint32_t drm_format = 0;
+	uint64_t modifier = 0;
+	uint32_t cx = 0;
+	uint32_t cy = 0;
+
+	bool operator==(const DmabufKey &other) const;
+};
+
+/* Returns false if a plane fd cannot be stat'ed */
+bool GetDmabufKey(const DmabufFrame &frame, DmabufKey &key);
+
+/* Creates and destroys the textures for DmabufTextureCache; the default one
+ * goes through the graphics subsystem, with the graphics context entered */
+class DmabufImporter {
+public:
+	virtual ~DmabufImporter() = default;
+
+	virtual gs_texture_t *Import(const DmabufFrame &frame) = 0;
+	virtual void Destroy(gs_texture_t *tex) = 0;
+};
+
+/* Textures imported from dmabufs, kept so that a frame painted into a buffer
+ * seen before only costs a lookup.  Owns its textures; all calls must be
+ * made with the graphics context entered when using the default importer. */
+class DmabufTextureCache {
+	struct Entry {
+		DmabufKey key;
+		bool keyed = false;
+		gs_texture_t *tex = nullptr;
+		uint64_t last_used = 0;
+	};
+
+	std::unique_ptr<DmabufImporter> importer;
+	std::vector<Entry> entries;
+	uint64_t use_count = 0;
+
+	void Evict(size_t idx);
+
+public:
+	std::atomic<uint64_t> hits = 0;
+	std::atomic<uint64_t> imports = 0;
+	std::atomic<uint64_t> evictions = 0;
+
+	/* importer is the graphics subsystem if null */
+	explicit DmabufTextureCache(std::unique_ptr<DmabufImporter> importer = nullptr);
+	~DmabufTextureCache();
+
+	/* Returns the texture of the frame's buffer, importing it if it is not
+	 * cached.  Buffers of another size or format than the frame's are
+	 * dropped first.  Returns nullptr if the import fails. */
+	gs_texture_t *Get(const DmabufFrame &frame);
+
+	bool Owns(gs_texture_t *tex) const;
+
+	/* Destroys all textures */
+	void Clear();
+
+	inline size_t Size() const { return entries.size(); }
+};
@@ -0,0 +1,303 @@
+#include "browser-frame-hash.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FRAME_HASH_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+/* The kernels follow the XXH3 long-input accumulation: four 64-bit lanes,
+ * each adding the 32x32->64 product of its keyed input plus the input of
+ * its neighbor lane.  Each of the HASH_STRIPES blocks of a stripe has its
+ * own key, and the lanes are scrambled after every stripe and every row,
+ * so that the same content at another place hashes differently.  Row
+ * tails that don't fill a 32 byte block go through a separate scalar
+ * accumulator shared by all kernels. */
+
+#define PRIME32_1 0x9E3779B1ULL
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+
+/* blocks per stripe, a FRAME_TILE_SIZE row of pixels */
+#define HASH_STRIPES 16
+
+/* splitmix64 output, four keys per block of a stripe */
+alignas(32) static const uint64_t hash_secret[HASH_STRIPES * 4] = {
+	0x8C9FF21EB4943E94ULL, 0x529BCFD80991254CULL, 0x12B8EB6D931B5E6EULL, 0xCEC50C5D0C1FCC21ULL,
+	0x31F5796E26EF1CA1ULL, 0x6FAD0E5AD91DFF82ULL, 0x061C22C6F5405433ULL, 0xACEBED3BE37886A1ULL,
+	0x0D81E8485A2713A6ULL, 0xA3E600F8F1FD238CULL, 0xEF1382C779E55F8EULL, 0xFE2C41FF60885D40ULL,
+	0x94CBB826DAC34BB2ULL, 0xB502428724A731F6ULL, 0xD0BEC29520B72715ULL, 0x81335F7CACFEBD80ULL,
+	0xE34BE0AABABD1D08ULL, 0x25C86B4D7EF8431AULL, 0x889C2B2A461FFB7EULL, 0x6A810FE6190B977EULL,
+	0xA24C7BA4F2058340ULL, 0xBA5C108702350F86ULL, 0x73B2EFD68E1C6856ULL, 0xC539D9C263EE450AULL,
+	0x6AAC6E25EF939A0DULL, 0x1E450828E05E8586ULL, 0x2799F9F71F51CFF0ULL, 0x463E244C7C8BA00BULL,
+	0x6A48C6E370FD7786ULL, 0x22A1E8B6CF76BD2FULL, 0xB294CF603AF4FAEFULL, 0x959B6129364BFB4BULL,
+	0x6FE5E120C950A2E6ULL, 0xA5F9ACFFF5F82621ULL, 0x987A3C2BC4291224ULL, 0xDDB9FDE3BC94D73AULL,
+	0x953FF75821E2D122ULL, 0xB53A2626CC3B5AB3ULL, 0xB8A97B8537F2DEA7ULL, 0x8C4E1474D5694475ULL,
+	0x27208610ADFB7FA6ULL, 0x6A0F5459E9C97027ULL, 0xC21FD10965D21F15ULL, 0x803F64BC7F9AA0EAULL,
+	0x5B1AFCB4BC2242A4ULL, 0x66D02409DCFC284AULL, 0x29F1DC2BCF4DA9C6ULL, 0x3EBCC7FE8313B062ULL,
+	0x15570133D5AD917AULL, 0x3FB63B9A2F7980FBULL, 0x103698C1A6C6FC22ULL, 0xBC2B92139F6BB7F8ULL,
+	0xC7F6A854CF4A3A5DULL, 0xFD75FA43A727CC68ULL, 0x094A2D438C093E67ULL, 0x655ED2E426005110ULL,
+	0x8026D68A4C327D07ULL, 0xBFE66AF9C8A13BC0ULL, 0xA0A7448B10E85048ULL, 0x912AAC64BD3A796CULL,
+	0x45567D12B6FF58B2ULL, 0x80007DE25DC6B613ULL, 0xFA9322E5773EB32BULL, 0x4CF0A3AA1C12B0EFULL,
+};
+alignas(32) static const uint64_t hash_init[4] = {PRIME32_1, PRIME64_1, PRIME64_2, PRIME64_3};
+
+static inline uint64_t Read64(const uint8_t *p)
+{
+	uint64_t val;
+	memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static inline uint32_t Read32(const uint8_t *p)
+{
+	uint32_t val;
+	memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static inline uint64_t Avalanche(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= 0x165667919E3779F9ULL;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint64_t MixTail(uint64_t h, const uint8_t *p, uint32_t bytes)
+{
+	while (bytes >= 4) {
+		h = (h ^ Read32(p)) * PRIME64_1;
+		h ^= h >> 29;
+		p += 4;
+		bytes -= 4;
+	}
+	while (bytes--)
+		h = (h ^ *p++) * PRIME64_2;
+	return h;
+}
+
+static inline uint64_t Scramble(uint64_t acc)
+{
+	acc ^= acc >> 47;
+	return acc * PRIME32_1;
+}
+
+static inline uint64_t Finalize(const uint64_t acc[4], uint64_t tail, uint64_t len)
+{
+	uint64_t h = len * PRIME64_1 ^ tail;
+	for (int i = 0; i < 4; i++) {
+		uint64_t x = acc[i] ^ hash_secret[i];
+		x ^= x >> 33;
+		x *= PRIME64_2;
+		x ^= x >> 29;
+		h = (h ^ x) * PRIME64_3;
+	}
+	return Avalanche(h);
+}
+
+static uint64_t HashScalar(const uint8_t *data, uint32_t linesize, uint32_t row_bytes, uint32_t rows)
+{
+	uint64_t acc[4] = {hash_init[0], hash_init[1], hash_init[2], hash_init[3]};
+	uint64_t tail = 0;
+	const uint32_t blocks = row_bytes / 32;
+	const uint32_t tail_bytes = row_bytes % 32;
+
+	for (uint32_t y = 0; y < rows; y++) {
+		const uint8_t *p = data + (size_t)y * linesize;
+
+		for (uint32_t b = 0; b < blocks; b++, p += 32) {
+			const uint64_t *key = hash_secret + (b % HASH_STRIPES) * 4;
+
+			for (int i = 0; i < 4; i++) {
+				const uint64_t d = Read64(p + i * 8);
+				const uint64_t k = d ^ key[i];
+				acc[i ^ 1] += d;
+				acc[i] += (k & 0xFFFFFFFFULL) * (k >> 32);
+			}
+
+			if (b % HASH_STRIPES == HASH_STRIPES - 1) {
+				for (uint64_t &lane : acc)
+					lane = Scramble(lane);
+			}
+		}
+
+		for (uint64_t &lane : acc)
+			lane = Scramble(lane);
+
+		if (tail_bytes)
+			tail = MixTail(tail, p, tail_bytes);
+	}
+
+	return Finalize(acc, tail, (uint64_t)row_bytes * rows);
+}
+
+#ifdef FRAME_HASH_X86
+/* 64x32 bit multiply, from the two 32x32 halves */
+static inline __m128i ScrambleSSE2(__m128i acc)
+{
+	const __m128i prime = _mm_set1_epi32((int)PRIME32_1);
+	acc = _mm_xor_si128(acc, _mm_srli_epi64(acc, 47));
+	const __m128i lo = _mm_mul_epu32(acc, prime);
+	const __m128i hi = _mm_mul_epu32(_mm_srli_epi64(acc, 32), prime);
+	return _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+}
+
+static uint64_t HashSSE2(const uint8_t *data, uint32_t linesize, uint32_t row_bytes, uint32_t rows)
+{
+	__m128i acc0 = _mm_load_si128((const __m128i *)hash_init);
+	__m128i acc1 = _mm_load_si128((const __m128i *)(hash_init + 2));
+	uint64_t tail = 0;
+	const uint32_t blocks = row_bytes / 32;
+	const uint32_t tail_bytes = row_bytes % 32;
+
+	for (uint32_t y = 0; y < rows; y++) {
+		const uint8_t *p = data + (size_t)y * linesize;
+
+		for (uint32_t b = 0; b < blocks; b++, p += 32) {
+			const uint64_t *key = hash_secret + (b % HASH_STRIPES) * 4;
+			const __m128i d0 = _mm_loadu_si128((const __m128i *)p);
+			const __m128i d1 = _mm_loadu_si128((const __m128i *)(p + 16));
+			const __m128i k0 = _mm_xor_si128(d0, _mm_load_si128((const __m128i *)key));
+			const __m128i k1 = _mm_xor_si128(d1, _mm_load_si128((const __m128i *)(key + 2)));
+
+			acc0 = _mm_add_epi64(acc0, _mm_mul_epu32(k0, _mm_shuffle_epi32(k0, _MM_SHUFFLE(0, 3, 0, 1))));
+			acc1 = _mm_add_epi64(acc1, _mm_mul_epu32(k1, _mm_shuffle_epi32(k1, _MM_SHUFFLE(0, 3, 0, 1))));
+			acc0 = _mm_add_epi64(acc0, _mm_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2)));
+			acc1 = _mm_add_epi64(acc1, _mm_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2)));
+
+			if (b % HASH_STRIPES == HASH_STRIPES - 1) {
+				acc0 = ScrambleSSE2(acc0);
+				acc1 = ScrambleSSE2(acc1);
+			}
+		}
+
+		acc0 = ScrambleSSE2(acc0);
+		acc1 = ScrambleSSE2(acc1);
+
+		if (tail_bytes)
+			tail = MixTail(tail, p, tail_bytes);
+	}
+
+	alignas(16) uint64_t acc[4];
+	_mm_store_si128((__m128i *)acc, acc0);
+	_mm_store_si128((__m128i *)(acc + 2), acc1);
+	return Finalize(acc, tail, (uint64_t)row_bytes * rows);
+}
+
+#ifndef _MSC_VER
+__attribute__((target("avx2")))
+#endif
+static inline __m256i ScrambleAVX2(__m256i acc)
+{
+	const __m256i prime = _mm256_set1_epi32((int)PRIME32_1);
+	acc = _mm256_xor_si256(acc, _mm256_srli_epi64(acc, 47));
+	const __m256i lo = _mm256_mul_epu32(acc, prime);
+	const __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(acc, 32), prime);
+	return _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+}
+
+#ifndef _MSC_VER
+__attribute__((target("avx2")))
+#endif
+static uint64_t HashAVX2(const uint8_t *data, uint32_t linesize, uint32_t row_bytes, uint32_t rows)
+{
+	__m256i acc_v = _mm256_load_si256((const __m256i *)hash_init);
+	uint64_t tail = 0;
+	const uint32_t blocks = row_bytes / 32;
+	const uint32_t tail_bytes = row_bytes % 32;
+
+	for (uint32_t y = 0; y < rows; y++) {
+		const uint8_t *p = data + (size_t)y * linesize;
+
+		for (uint32_t b = 0; b < blocks; b++, p += 32) {
+			const __m256i key = _mm256_load_si256((const __m256i *)(hash_secret + (b % HASH_STRIPES) * 4));
+			const __m256i d = _mm256_loadu_si256((const __m256i *)p);
+			const __m256i k = _mm256_xor_si256(d, key);
+
+			const __m256i prod = _mm256_mul_epu32(k, _mm256_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1)));
+
+			acc_v = _mm256_add_epi64(acc_v, prod);
+			acc_v = _mm256_add_epi64(acc_v, _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+
+			if (b % HASH_STRIPES == HASH_STRIPES - 1)
+				acc_v = ScrambleAVX2(acc_v);
+		}
+
+		acc_v = ScrambleAVX2(acc_v);
+
+		if (tail_bytes)
+			tail = MixTail(tail, p, tail_bytes);
+	}
+
+	alignas(32) uint64_t acc[4];
+	_mm256_store_si256((__m256i *)acc, acc_v);
+	return Finalize(acc, tail, (uint64_t)row_bytes * rows);
+}
+
+bool CpuHasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	/* AVX support, and the OS saving the YMM registers */
+	__cpuid(info, 1);
+	if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)))
+		return false;
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+typedef uint64_t (*hash_func_t)(const uint8_t *data, uint32_t linesize, uint32_t row_bytes, uint32_t rows);
+
+static hash_func_t GetHashFunc(HashKernel kernel)
+{
+	switch (kernel) {
+	case HashKernel::Scalar:
+		return HashScalar;
+#ifdef FRAME_HASH_X86
+	case HashKernel::SSE2:
+		return HashSSE2;
+	case HashKernel::AVX2:
+		return CpuHasAVX2() ? HashAVX2 : nullptr;
+	default:
+		return CpuHasAVX2() ? HashAVX2 : HashSSE2;
+#else
+	case HashKernel::Auto:
+		return HashScalar;
+	default:
+		return nullptr;
+#endif
+	}
+}
+
+bool HashKernelSupported(HashKernel kernel)
+{
+	return GetHashFunc(kernel) != nullptr;
+}
+
+uint64_t HashFrameRegion(const uint8_t *data, uint32_t linesize, uint32_t row_bytes, uint32_t rows)
+{
+	static const hash_func_t hash_func = GetHashFunc(HashKernel::Auto);
+	return hash_func(data, linesize, row_bytes, rows);
+}
+
+uint64_t HashFrameRegion(const uint8_t *data, uint32_t linesize, uint32_t row_bytes, uint32_t rows, HashKernel kernel)
+{
+	return GetHashFunc(kernel)(data, linesize, row_bytes, rows);
+}
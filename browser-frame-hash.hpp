@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+/* Hashes a region of pixel rows.  An AVX2, SSE2 or scalar kernel is picked
+ * at runtime; all of them return the same value for the same input. */
+uint64_t HashFrameRegion(const uint8_t *data, uint32_t linesize, uint32_t row_bytes, uint32_t rows);
+
+/* The kernels, for tests and benchmarks */
+enum class HashKernel {
+	Auto,
+	Scalar,
+	SSE2,
+	AVX2,
+};
+
+/* Whether a kernel is built in and supported by the CPU */
+bool HashKernelSupported(HashKernel kernel);
+
+/* Hashes with a given kernel, which must be supported */
+uint64_t HashFrameRegion(const uint8_t *data, uint32_t linesize, uint32_t row_bytes, uint32_t rows, HashKernel kernel);
+
+#if defined(__x86_64__) || defined(_M_X64)
+/* Whether the CPU and OS support AVX2, for the runtime kernel selection */
+bool CpuHasAVX2();
+#endif
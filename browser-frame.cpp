@@ -0,0 +1,515 @@
+#include "browser-frame.hpp"
+#include "browser-frame-hash.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ALPHA_SCAN_SSE2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define ALPHA_SCAN_NEON 1
+#endif
+
+/* Merge two rects if their bounding box wastes less than this many pixels
+ * (plus 25%) compared to copying them separately */
+#define MERGE_SLACK (64 * 64)
+#define MAX_FRAME_RECTS 16
+
+/* Dirty area (in percent of the frame) above which a full upload is used */
+#define FULL_UPLOAD_PERCENT 60
+
+static inline FrameRect UnionFrameRect(const FrameRect &a, const FrameRect &b)
+{
+	const uint32_t x = std::min(a.x, b.x);
+	const uint32_t y = std::min(a.y, b.y);
+	const uint32_t r = std::max(a.x + a.cx, b.x + b.cx);
+	const uint32_t bottom = std::max(a.y + a.cy, b.y + b.cy);
+
+	FrameRect u;
+	u.x = x;
+	u.y = y;
+	u.cx = r - x;
+	u.cy = bottom - y;
+	return u;
+}
+
+bool ClipFrameRect(FrameRect &rect, uint32_t cx, uint32_t cy)
+{
+	if (rect.x >= cx || rect.y >= cy)
+		return false;
+
+	rect.cx = std::min(rect.cx, cx - rect.x);
+	rect.cy = std::min(rect.cy, cy - rect.y);
+	return rect.cx && rect.cy;
+}
+
+void MergeFrameRects(std::vector<FrameRect> &rects)
+{
+	bool merged;
+
+	do {
+		merged = false;
+
+		for (size_t i = 0; i < rects.size() && !merged; i++) {
+			for (size_t j = i + 1; j < rects.size(); j++) {
+				const FrameRect u = UnionFrameRect(rects[i], rects[j]);
+				const uint64_t parts = rects[i].Area() + rects[j].Area();
+
+				if (u.Area() <= parts + parts / 4 + MERGE_SLACK) {
+					rects[i] = u;
+					rects.erase(rects.begin() + j);
+					merged = true;
+					break;
+				}
+			}
+		}
+	} while (merged);
+
+	if (rects.size() > MAX_FRAME_RECTS) {
+		FrameRect u = rects[0];
+		for (size_t i = 1; i < rects.size(); i++)
+			u = UnionFrameRect(u, rects[i]);
+
+		rects.clear();
+		rects.push_back(u);
+	}
+}
+
+void IntersectFrameRects(std::vector<FrameRect> &rects, const std::vector<FrameRect> &clip)
+{
+	std::vector<FrameRect> result;
+
+	for (const FrameRect &rect : rects) {
+		for (const FrameRect &c : clip) {
+			const uint32_t x = std::max(rect.x, c.x);
+			const uint32_t y = std::max(rect.y, c.y);
+			const uint32_t r = std::min(rect.x + rect.cx, c.x + c.cx);
+			const uint32_t bottom = std::min(rect.y + rect.cy, c.y + c.cy);
+			if (x >= r || y >= bottom)
+				continue;
+
+			FrameRect i;
+			i.x = x;
+			i.y = y;
+			i.cx = r - x;
+			i.cy = bottom - y;
+			result.push_back(i);
+		}
+	}
+
+	rects.swap(result);
+}
+
+void AddUncoveredRects(std::vector<FrameRect> &rects, const std::vector<FrameRect> &live,
+		       const std::vector<FrameRect> &prev)
+{
+	std::vector<std::pair<uint32_t, uint32_t>> covered;
+
+	for (const FrameRect &run : live) {
+		covered.clear();
+		for (const FrameRect &p : prev) {
+			if (p.y > run.y || p.y + p.cy < run.y + run.cy)
+				continue;
+
+			const uint32_t x = std::max(run.x, p.x);
+			const uint32_t r = std::min(run.x + run.cx, p.x + p.cx);
+			if (x < r)
+				covered.emplace_back(x, r);
+		}
+		std::sort(covered.begin(), covered.end());
+
+		uint32_t x = run.x;
+		const uint32_t right = run.x + run.cx;
+		for (const auto &span : covered) {
+			if (span.first > x)
+				rects.push_back(FrameRect{x, run.y, span.first - x, run.cy});
+			x = std::max(x, span.second);
+		}
+		if (x < right)
+			rects.push_back(FrameRect{x, run.y, right - x, run.cy});
+	}
+}
+
+static inline bool PartialUploadSupported()
+{
+	/* D3D11 maps dynamic textures with WRITE_DISCARD, so anything that
+	 * is not rewritten after a map is undefined.  The OpenGL backend maps
+	 * a persistent unpack buffer, which keeps the previous frame. */
+	return gs_get_device_type() == GS_DEVICE_OPENGL;
+}
+
+size_t UploadFrame(gs_texture_t *tex, const uint8_t *data, uint32_t linesize, uint32_t cx, uint32_t cy,
+		   std::vector<FrameRect> &rects)
+{
+	const size_t full_size = (size_t)linesize * cy;
+
+	MergeFrameRects(rects);
+
+	uint64_t area = 0;
+	for (const FrameRect &rect : rects)
+		area += rect.Area();
+
+	if (rects.empty() || !PartialUploadSupported() ||
+	    area * 100 >= (uint64_t)cx * (uint64_t)cy * FULL_UPLOAD_PERCENT) {
+		gs_texture_set_image(tex, data, linesize, false);
+		return full_size;
+	}
+
+	uint8_t *ptr;
+	uint32_t tex_linesize;
+	if (!gs_texture_map(tex, &ptr, &tex_linesize)) {
+		gs_texture_set_image(tex, data, linesize, false);
+		return full_size;
+	}
+
+	const size_t bytes = CopyFrameRects(ptr, tex_linesize, data, linesize, rects);
+	gs_texture_unmap(tex);
+	return bytes;
+}
+
+size_t CopyFrameRects(uint8_t *dst_data, uint32_t dst_linesize, const uint8_t *data, uint32_t linesize,
+		      const std::vector<FrameRect> &rects)
+{
+	size_t bytes = 0;
+	for (const FrameRect &rect : rects) {
+		const size_t row_size = (size_t)rect.cx * 4;
+		const uint8_t *src = data + (size_t)rect.y * linesize + (size_t)rect.x * 4;
+		uint8_t *dst = dst_data + (size_t)rect.y * dst_linesize + (size_t)rect.x * 4;
+
+		if (row_size == linesize && linesize == dst_linesize) {
+			memcpy(dst, src, row_size * rect.cy);
+		} else {
+			for (uint32_t y = 0; y < rect.cy; y++) {
+				memcpy(dst, src, row_size);
+				src += linesize;
+				dst += dst_linesize;
+			}
+		}
+
+		bytes += row_size * rect.cy;
+	}
+	return bytes;
+}
+
+bool FrameTiles::HashTile(const uint8_t *data, uint32_t linesize, uint32_t idx)
+{
+	const uint32_t x = (idx % cols) * FRAME_TILE_SIZE;
+	const uint32_t y = (idx / cols) * FRAME_TILE_SIZE;
+	const uint32_t tile_cx = std::min((uint32_t)FRAME_TILE_SIZE, cx - x);
+	const uint32_t tile_cy = std::min((uint32_t)FRAME_TILE_SIZE, cy - y);
+
+	const uint8_t *tile = data + (size_t)y * linesize + (size_t)x * 4;
+	const uint64_t hash = HashFrameRegion(tile, linesize, tile_cx * 4, tile_cy);
+	const bool tile_changed = hash != hashes[idx];
+	hashes[idx] = hash;
+	return tile_changed;
+}
+
+bool FrameTiles::Update(const uint8_t *data, uint32_t linesize, uint32_t cx_, uint32_t cy_,
+			std::vector<FrameRect> &rects)
+{
+	if (cx_ != cx || cy_ != cy) {
+		cx = cx_;
+		cy = cy_;
+		cols = (cx + FRAME_TILE_SIZE - 1) / FRAME_TILE_SIZE;
+		rows = (cy + FRAME_TILE_SIZE - 1) / FRAME_TILE_SIZE;
+		hashes.assign((size_t)cols * rows, 0);
+		visited.assign((size_t)cols * rows, 0);
+		changed.assign((size_t)cols * rows, false);
+		stamp = 0;
+
+		for (uint32_t i = 0; i < cols * rows; i++)
+			HashTile(data, linesize, i);
+		return true;
+	}
+
+	if (++stamp == 0) {
+		visited.assign(visited.size(), 0);
+		stamp = 1;
+	}
+
+	auto it = rects.begin();
+	while (it != rects.end()) {
+		const FrameRect &rect = *it;
+		const uint32_t tx0 = rect.x / FRAME_TILE_SIZE;
+		const uint32_t ty0 = rect.y / FRAME_TILE_SIZE;
+		const uint32_t tx1 = (rect.x + rect.cx - 1) / FRAME_TILE_SIZE;
+		const uint32_t ty1 = (rect.y + rect.cy - 1) / FRAME_TILE_SIZE;
+		bool rect_changed = false;
+
+		for (uint32_t ty = ty0; ty <= ty1; ty++) {
+			for (uint32_t tx = tx0; tx <= tx1; tx++) {
+				const uint32_t idx = ty * cols + tx;
+
+				if (visited[idx] != stamp) {
+					visited[idx] = stamp;
+					changed[idx] = HashTile(data, linesize, idx);
+				}
+
+				rect_changed = rect_changed || changed[idx];
+			}
+		}
+
+		if (rect_changed)
+			++it;
+		else
+			it = rects.erase(it);
+	}
+
+	return !rects.empty();
+}
+
+/* ORs the alpha of every pixel of a row into a per-column accumulator,
+ * returns whether the row had any non-zero alpha */
+static inline bool AccumulateAlphaRow(const uint8_t *row, uint32_t cx, uint32_t *columns)
+{
+	uint32_t x = 0;
+	uint32_t row_alpha = 0;
+
+#if defined(ALPHA_SCAN_SSE2)
+	const __m128i alpha_mask = _mm_set1_epi32((int)0xFF000000);
+	__m128i row_acc = _mm_setzero_si128();
+
+	for (; x + 4 <= cx; x += 4) {
+		const __m128i px = _mm_and_si128(_mm_loadu_si128((const __m128i *)(row + x * 4)), alpha_mask);
+		__m128i *col = (__m128i *)(columns + x);
+
+		_mm_storeu_si128(col, _mm_or_si128(_mm_loadu_si128(col), px));
+		row_acc = _mm_or_si128(row_acc, px);
+	}
+
+	row_alpha = _mm_movemask_epi8(_mm_cmpeq_epi32(row_acc, _mm_setzero_si128())) != 0xFFFF;
+#elif defined(ALPHA_SCAN_NEON)
+	const uint32x4_t alpha_mask = vdupq_n_u32(0xFF000000);
+	uint32x4_t row_acc = vdupq_n_u32(0);
+
+	for (; x + 4 <= cx; x += 4) {
+		const uint32x4_t px = vandq_u32(vld1q_u32((const uint32_t *)(row + x * 4)), alpha_mask);
+
+		vst1q_u32(columns + x, vorrq_u32(vld1q_u32(columns + x), px));
+		row_acc = vorrq_u32(row_acc, px);
+	}
+
+	row_alpha = vmaxvq_u32(row_acc);
+#endif
+
+	for (; x < cx; x++) {
+		const uint32_t alpha = row[x * 4 + 3];
+		columns[x] |= alpha;
+		row_alpha |= alpha;
+	}
+
+	return row_alpha != 0;
+}
+
+void AlphaBounds::ScanTile(const uint8_t *data, uint32_t linesize, uint32_t idx)
+{
+	const uint32_t x = (idx % cols) * FRAME_TILE_SIZE;
+	const uint32_t y = (idx / cols) * FRAME_TILE_SIZE;
+	const uint32_t tile_cx = std::min((uint32_t)FRAME_TILE_SIZE, cx - x);
+	const uint32_t tile_cy = std::min((uint32_t)FRAME_TILE_SIZE, cy - y);
+	const uint8_t *tile = data + (size_t)y * linesize + (size_t)x * 4;
+
+	uint32_t columns[FRAME_TILE_SIZE] = {};
+	uint32_t top = tile_cy;
+	uint32_t bottom = 0;
+
+	for (uint32_t row = 0; row < tile_cy; row++) {
+		if (AccumulateAlphaRow(tile + (size_t)row * linesize, tile_cx, columns)) {
+			top = std::min(top, row);
+			bottom = row + 1;
+		}
+	}
+
+	FrameRect &bounds = tile_bounds[idx];
+	bounds = FrameRect();
+	if (top >= bottom)
+		return;
+
+	uint32_t left = 0;
+	uint32_t right = tile_cx;
+	while (!columns[left])
+		left++;
+	while (!columns[right - 1])
+		right--;
+
+	bounds.x = x + left;
+	bounds.y = y + top;
+	bounds.cx = right - left;
+	bounds.cy = bottom - top;
+}
+
+FrameRect AlphaBounds::Update(const uint8_t *data, uint32_t linesize, uint32_t cx_, uint32_t cy_,
+			      const std::vector<FrameRect> &rects, std::vector<FrameRect> &live)
+{
+	if (cx_ != cx || cy_ != cy) {
+		cx = cx_;
+		cy = cy_;
+		cols = (cx + FRAME_TILE_SIZE - 1) / FRAME_TILE_SIZE;
+		rows = (cy + FRAME_TILE_SIZE - 1) / FRAME_TILE_SIZE;
+		tile_bounds.assign((size_t)cols * rows, FrameRect());
+
+		for (uint32_t i = 0; i < cols * rows; i++)
+			ScanTile(data, linesize, i);
+	} else {
+		/* tiles touched by several rects are only scanned once */
+		dirty_tiles.assign(tile_bounds.size(), false);
+
+		for (const FrameRect &rect : rects) {
+			const uint32_t tx0 = rect.x / FRAME_TILE_SIZE;
+			const uint32_t ty0 = rect.y / FRAME_TILE_SIZE;
+			const uint32_t tx1 = (rect.x + rect.cx - 1) / FRAME_TILE_SIZE;
+			const uint32_t ty1 = (rect.y + rect.cy - 1) / FRAME_TILE_SIZE;
+
+			for (uint32_t ty = ty0; ty <= ty1; ty++)
+				for (uint32_t tx = tx0; tx <= tx1; tx++)
+					dirty_tiles[ty * cols + tx] = true;
+		}
+
+		for (uint32_t i = 0; i < cols * rows; i++) {
+			if (dirty_tiles[i])
+				ScanTile(data, linesize, i);
+		}
+	}
+
+	FrameRect bounds;
+	for (const FrameRect &tile : tile_bounds) {
+		if (!tile.cx)
+			continue;
+		bounds = bounds.cx ? UnionFrameRect(bounds, tile) : tile;
+	}
+
+	live.clear();
+	for (uint32_t ty = 0; ty < rows; ty++) {
+		const uint32_t y = ty * FRAME_TILE_SIZE;
+
+		for (uint32_t tx = 0; tx < cols; tx++) {
+			if (!tile_bounds[ty * cols + tx].cx)
+				continue;
+
+			const uint32_t first = tx;
+			while (tx + 1 < cols && tile_bounds[ty * cols + tx + 1].cx)
+				tx++;
+
+			FrameRect run;
+			run.x = first * FRAME_TILE_SIZE;
+			run.y = y;
+			run.cx = std::min((tx + 1) * FRAME_TILE_SIZE, cx) - run.x;
+			run.cy = std::min(y + FRAME_TILE_SIZE, cy) - y;
+			live.push_back(run);
+		}
+	}
+
+	return bounds;
+}
+
+bool FrameQueue::CollectRects(uint64_t since, std::vector<FrameRect> &rects) const
+{
+	rects.clear();
+
+	if (!since || since < size_seq || seq - since > HISTORY)
+		return false;
+
+	for (uint64_t i = since + 1; i <= seq; i++) {
+		const std::vector<FrameRect> &frame_rects = history[i % HISTORY];
+		rects.insert(rects.end(), frame_rects.begin(), frame_rects.end());
+	}
+
+	return true;
+}
+
+bool FrameQueue::Push(const uint8_t *data, uint32_t linesize, uint32_t cx, uint32_t cy,
+		      const std::vector<FrameRect> &dirty, const FrameRect &bounds, const std::vector<FrameRect> &live)
+{
+	CpuFrame &frame = frames[write_index];
+	const size_t size = (size_t)cx * cy * 4;
+
+	if (cx != last_cx || cy != last_cy) {
+		size_seq = seq + 1;
+		last_cx = cx;
+		last_cy = cy;
+	}
+
+	seq++;
+	history[seq % HISTORY] = dirty;
+
+	/* the slot still holds an older frame, so only what changed since
+	 * then has to be copied in */
+	std::vector<FrameRect> copy_rects;
+	if (frame.data.size() == size && CollectRects(frame.seq, copy_rects)) {
+		MergeFrameRects(copy_rects);
+
+		for (const FrameRect &rect : copy_rects) {
+			const size_t row_size = (size_t)rect.cx * 4;
+			const uint8_t *src = data + (size_t)rect.y * linesize + (size_t)rect.x * 4;
+			uint8_t *dst = frame.data.data() + (size_t)rect.y * frame.linesize + (size_t)rect.x * 4;
+
+			for (uint32_t y = 0; y < rect.cy; y++) {
+				memcpy(dst, src, row_size);
+				src += linesize;
+				dst += frame.linesize;
+			}
+		}
+	} else {
+		frame.data.resize(size);
+		frame.cx = cx;
+		frame.cy = cy;
+		frame.linesize = cx * 4;
+
+		if (linesize == frame.linesize) {
+			memcpy(frame.data.data(), data, size);
+		} else {
+			for (uint32_t y = 0; y < cy; y++)
+				memcpy(frame.data.data() + (size_t)y * frame.linesize, data + (size_t)y * linesize,
+				       frame.linesize);
+		}
+	}
+
+	frame.seq = seq;
+	frame.bounds = bounds;
+	frame.live = live;
+	frame.full = !CollectRects(consumed_seq.load(std::memory_order_acquire), frame.rects);
+
+	const int prev = ready.exchange(write_index | FRESH, std::memory_order_acq_rel);
+	write_index = prev & INDEX_MASK;
+	return (prev & FRESH) != 0;
+}
+
+CpuFrame *FrameQueue::Pop()
+{
+	if (!(ready.load(std::memory_order_relaxed) & FRESH))
+		return nullptr;
+
+	const int prev = ready.exchange(read_index, std::memory_order_acq_rel);
+	read_index = prev & INDEX_MASK;
+	read_valid = true;
+
+	CpuFrame *frame = &frames[read_index];
+	consumed_seq.store(frame->seq, std::memory_order_release);
+	return frame;
+}
+
+CpuFrame *FrameQueue::Current()
+{
+	return read_valid ? &frames[read_index] : nullptr;
+}
+
+void FrameQueue::Reset()
+{
+	for (CpuFrame &frame : frames)
+		frame = CpuFrame();
+	for (std::vector<FrameRect> &rects : history)
+		std::vector<FrameRect>().swap(rects);
+
+	ready = 1;
+	consumed_seq = 0;
+	write_index = 0;
+	seq = 0;
+	size_seq = 0;
+	last_cx = 0;
+	last_cy = 0;
+	read_index = 2;
+	read_valid = false;
+}
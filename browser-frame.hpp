@@ -0,0 +1,160 @@
+#pragma once
+
+#include <graphics/graphics.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* Dirty region of a CPU painted frame, in pixels */
+struct FrameRect {
+	uint32_t x = 0;
+	uint32_t y = 0;
+	uint32_t cx = 0;
+	uint32_t cy = 0;
+
+	inline uint64_t Area() const { return (uint64_t)cx * (uint64_t)cy; }
+};
+
+/* Clips a rect to a cx * cy frame, returns false if nothing is left */
+bool ClipFrameRect(FrameRect &rect, uint32_t cx, uint32_t cy);
+
+/* Coalesces nearby dirty rects so that small scattered updates (tickers,
+ * clocks) end up as a handful of row copies rather than dozens */
+void MergeFrameRects(std::vector<FrameRect> &rects);
+
+/* Restricts rects to the parts covered by the (non-overlapping) clip rects */
+void IntersectFrameRects(std::vector<FrameRect> &rects, const std::vector<FrameRect> &clip);
+
+/* Adds the parts of the live tile runs that prev does not cover, i.e.
+ * tiles that have become visible again and whose texture contents are
+ * stale.  A run only counts as covered by prev rects spanning all of its
+ * rows. */
+void AddUncoveredRects(std::vector<FrameRect> &rects, const std::vector<FrameRect> &live,
+		       const std::vector<FrameRect> &prev);
+
+/* Uploads a BGRA frame into a GS_DYNAMIC texture of the same size.  Only
+ * the dirty rects are copied when the graphics backend keeps the contents
+ * of a mapped texture; otherwise, or if the dirty area covers most of the
+ * frame, the whole image is uploaded.  Must be called with the graphics
+ * context entered.  Returns the number of bytes copied. */
+size_t UploadFrame(gs_texture_t *tex, const uint8_t *data, uint32_t linesize, uint32_t cx, uint32_t cy,
+		   std::vector<FrameRect> &rects);
+
+/* The copy of a partial upload, into a mapped texture.  Returns the
+ * number of bytes copied. */
+size_t CopyFrameRects(uint8_t *dst, uint32_t dst_linesize, const uint8_t *data, uint32_t linesize,
+		      const std::vector<FrameRect> &rects);
+
+#define FRAME_TILE_SIZE 128
+
+/* Content hashes of the last painted frame, split into tiles */
+class FrameTiles {
+	uint32_t cx = 0;
+	uint32_t cy = 0;
+	uint32_t cols = 0;
+	uint32_t rows = 0;
+	std::vector<uint64_t> hashes;
+	std::vector<uint32_t> visited;
+	std::vector<bool> changed;
+	uint32_t stamp = 0;
+
+	bool HashTile(const uint8_t *data, uint32_t linesize, uint32_t idx);
+
+public:
+	/* Rehashes the tiles touched by the dirty rects and drops rects whose
+	 * tiles did not change.  Returns false if nothing changed at all, i.e.
+	 * the frame is a duplicate of the previous one. */
+	bool Update(const uint8_t *data, uint32_t linesize, uint32_t cx, uint32_t cy, std::vector<FrameRect> &rects);
+};
+
+/* Bounding box of the pixels with non-zero alpha, kept per tile so that
+ * only the tiles touched by dirty rects have to be scanned again */
+class AlphaBounds {
+	uint32_t cx = 0;
+	uint32_t cy = 0;
+	uint32_t cols = 0;
+	uint32_t rows = 0;
+	std::vector<FrameRect> tile_bounds;
+	std::vector<bool> dirty_tiles;
+
+	void ScanTile(const uint8_t *data, uint32_t linesize, uint32_t idx);
+
+public:
+	/* Returns the bounds of the visible content; cx/cy are zero if the
+	 * frame is entirely transparent.  Runs of horizontally adjacent
+	 * tiles that have visible content are returned in live. */
+	FrameRect Update(const uint8_t *data, uint32_t linesize, uint32_t cx, uint32_t cy,
+			 const std::vector<FrameRect> &rects, std::vector<FrameRect> &live);
+};
+
+/* BGRA frame copied out of CEF's paint buffer */
+struct CpuFrame {
+	std::vector<uint8_t> data;
+	uint32_t cx = 0;
+	uint32_t cy = 0;
+	uint32_t linesize = 0;
+	uint64_t seq = 0;
+
+	/* Regions that changed since the frame the consumer took before this
+	 * one, unless full is set */
+	std::vector<FrameRect> rects;
+	bool full = true;
+
+	/* Visible (non-transparent) part of the frame, and the tile runs
+	 * that have visible content.  Nothing outside of them is uploaded
+	 * or drawn. */
+	FrameRect bounds;
+	std::vector<FrameRect> live;
+};
+
+/* Lock-free triple buffer handing CPU frames from the CEF UI thread to the
+ * graphics thread.  The producer always has a free slot to paint into and
+ * the consumer only ever sees the newest published frame; frames that are
+ * superseded before being taken are dropped, their dirty regions carried
+ * over to the next one. */
+class FrameQueue {
+	static constexpr int FRESH = 4;
+	static constexpr int INDEX_MASK = 3;
+	static constexpr uint64_t HISTORY = 8;
+
+	CpuFrame frames[3];
+	std::atomic<int> ready = 1;
+	std::atomic<uint64_t> consumed_seq = 0;
+
+	/* producer */
+	int write_index = 0;
+	uint64_t seq = 0;
+	uint64_t size_seq = 0;
+	uint32_t last_cx = 0;
+	uint32_t last_cy = 0;
+	std::vector<FrameRect> history[HISTORY];
+
+	/* consumer */
+	int read_index = 2;
+	bool read_valid = false;
+
+	bool CollectRects(uint64_t since, std::vector<FrameRect> &rects) const;
+
+public:
+	/* Producer: copies a frame in and publishes it.  Returns true if an
+	 * unconsumed frame was dropped in favor of this one. */
+	bool Push(const uint8_t *data, uint32_t linesize, uint32_t cx, uint32_t cy,
+		  const std::vector<FrameRect> &dirty, const FrameRect &bounds, const std::vector<FrameRect> &live);
+
+	/* Consumer: takes the newest frame if one was published since the
+	 * last call, otherwise returns nullptr */
+	CpuFrame *Pop();
+
+	/* Consumer: the last frame taken, if any */
+	CpuFrame *Current();
+
+	/* Whether a published frame has not been taken by the consumer yet */
+	inline bool Pending() const { return (ready.load(std::memory_order_acquire) & FRESH) != 0; }
+
+	/* Consumer: forgets the last frame taken */
+	inline void Clear() { read_valid = false; }
+
+	/* Frees all frame memory.  Neither side may be in use. */
+	void Reset();
+};
@@ -0,0 +1,169 @@
+#include "browser-loop.hpp"
+
+#include <util/base.h>
+#include <algorithm>
+#include <cstring>
+
+bool FrameLoop::Fail(const char *reason)
+{
+	blog(LOG_WARNING, "[obs-browser]: Loop capture failed: %s", reason);
+
+	keyframe = std::vector<uint8_t>();
+	loop_frames = std::vector<LoopFrame>();
+	pixels = std::vector<uint8_t>();
+	state.store(State::Failed, std::memory_order_release);
+	return false;
+}
+
+void FrameLoop::Record(const uint8_t *data, uint32_t linesize, uint32_t cx_, uint32_t cy_,
+		       const std::vector<FrameRect> &dirty, uint64_t ts, uint64_t duration, size_t max)
+{
+	const State cur_state = GetState();
+	if (cur_state == State::Complete || cur_state == State::Failed)
+		return;
+
+	const size_t frame_size = (size_t)cx_ * cy_ * 4;
+
+	if (cur_state == State::Idle) {
+		/* the keyframe plus the buffer it gets replayed in */
+		if (frame_size * 2 > max) {
+			Fail("loop does not fit in the memory limit");
+			return;
+		}
+
+		cx = cx_;
+		cy = cy_;
+		start_ts = ts;
+		duration_ns = duration;
+		end_ts.store(ts + duration, std::memory_order_relaxed);
+		max_bytes = max;
+
+		keyframe.resize(frame_size);
+		for (uint32_t y = 0; y < cy; y++)
+			memcpy(keyframe.data() + (size_t)y * cx * 4, data + (size_t)y * linesize, (size_t)cx * 4);
+
+		state.store(State::Recording, std::memory_order_release);
+		return;
+	}
+
+	if (cx_ != cx || cy_ != cy) {
+		Fail("page was resized while recording");
+		return;
+	}
+
+	if (ts - start_ts >= duration_ns) {
+		Finish(ts);
+		return;
+	}
+
+	LoopFrame frame;
+	frame.ts = ts - start_ts;
+	frame.offset = pixels.size();
+
+	size_t bytes = 0;
+	for (FrameRect rect : dirty) {
+		if (!ClipFrameRect(rect, cx, cy))
+			continue;
+		frame.rects.push_back(rect);
+		bytes += (size_t)rect.Area() * 4;
+	}
+
+	if (frame.rects.empty())
+		return;
+
+	const size_t used = keyframe.size() * 2 + pixels.size() + bytes +
+			    (loop_frames.size() + 1) * sizeof(LoopFrame);
+	if (used > max_bytes) {
+		Fail("loop does not fit in the memory limit");
+		return;
+	}
+
+	pixels.resize(frame.offset + bytes);
+	uint8_t *dst = pixels.data() + frame.offset;
+
+	for (const FrameRect &rect : frame.rects) {
+		const size_t row_size = (size_t)rect.cx * 4;
+		const uint8_t *src = data + (size_t)rect.y * linesize + (size_t)rect.x * 4;
+
+		for (uint32_t y = 0; y < rect.cy; y++) {
+			memcpy(dst, src, row_size);
+			src += linesize;
+			dst += row_size;
+		}
+	}
+
+	loop_frames.push_back(std::move(frame));
+}
+
+void FrameLoop::Finish(uint64_t ts)
+{
+	if (GetState() != State::Recording || ts - start_ts < duration_ns)
+		return;
+
+	current = keyframe;
+	current_idx = 0;
+	state.store(State::Complete, std::memory_order_release);
+	blog(LOG_INFO, "[obs-browser]: Captured a %u ms loop: %zu frames, %zu bytes",
+	     (uint32_t)(duration_ns / 1000000), Frames(), Bytes());
+}
+
+void FrameLoop::Reset()
+{
+	keyframe = std::vector<uint8_t>();
+	loop_frames = std::vector<LoopFrame>();
+	pixels = std::vector<uint8_t>();
+	current = std::vector<uint8_t>();
+	current_idx = 0;
+	cx = 0;
+	cy = 0;
+	state.store(State::Idle, std::memory_order_release);
+}
+
+bool FrameLoop::Seek(uint64_t t, std::vector<FrameRect> &rects, bool &full)
+{
+	rects.clear();
+	full = false;
+
+	if (!Complete() || !duration_ns)
+		return false;
+
+	const uint64_t pos = t % duration_ns;
+
+	/* index 0 is the keyframe, index n the (n - 1)th delta */
+	auto it = std::upper_bound(loop_frames.begin(), loop_frames.end(), pos,
+				   [](uint64_t val, const LoopFrame &frame) { return val < frame.ts; });
+	const size_t target = (size_t)(it - loop_frames.begin());
+
+	if (target == current_idx)
+		return false;
+
+	if (target < current_idx) {
+		current = keyframe;
+		current_idx = 0;
+		full = true;
+	}
+
+	const size_t linesize = (size_t)cx * 4;
+
+	for (size_t i = current_idx; i < target; i++) {
+		const LoopFrame &frame = loop_frames[i];
+		const uint8_t *src = pixels.data() + frame.offset;
+
+		for (const FrameRect &rect : frame.rects) {
+			const size_t row_size = (size_t)rect.cx * 4;
+			uint8_t *dst = current.data() + (size_t)rect.y * linesize + (size_t)rect.x * 4;
+
+			for (uint32_t y = 0; y < rect.cy; y++) {
+				memcpy(dst, src, row_size);
+				src += row_size;
+				dst += linesize;
+			}
+
+			if (!full)
+				rects.push_back(rect);
+		}
+	}
+
+	current_idx = target;
+	return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "browser-frame.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* A few seconds of frames recorded from the CPU paint path, so that a
+ * looping page can be replayed after its browser has been closed.  The
+ * first frame is stored whole, every following one only as the regions
+ * that changed since the frame before it.
+ *
+ * Recording happens on the CEF UI thread.  Once Complete() returns true
+ * the recording is no longer touched by it and can be replayed on the
+ * graphics thread. */
+class FrameLoop {
+public:
+	enum class State : int {
+		Idle,
+		Recording,
+		Complete,
+		Failed,
+	};
+
+private:
+	struct LoopFrame {
+		uint64_t ts;
+		std::vector<FrameRect> rects;
+		size_t offset;
+	};
+
+	std::atomic<State> state = State::Idle;
+
+	uint32_t cx = 0;
+	uint32_t cy = 0;
+	uint64_t start_ts = 0;
+	uint64_t duration_ns = 0;
+	std::atomic<uint64_t> end_ts = 0;
+	size_t max_bytes = 0;
+
+	std::vector<uint8_t> keyframe;
+	std::vector<LoopFrame> loop_frames;
+	std::vector<uint8_t> pixels;
+
+	/* replay */
+	std::vector<uint8_t> current;
+	size_t current_idx = 0;
+
+	bool Fail(const char *reason);
+
+public:
+	/* Recorder: adds a painted frame, starting a new recording if none
+	 * is running.  Paints are ignored once the loop is complete. */
+	void Record(const uint8_t *data, uint32_t linesize, uint32_t cx, uint32_t cy,
+		    const std::vector<FrameRect> &dirty, uint64_t ts, uint64_t duration_ns, size_t max_bytes);
+
+	/* Recorder: completes the recording once it is ts long, the last
+	 * frame recorded lasting until the end of the loop.  Paints are only
+	 * recorded when the content changed, so a page ending on a still
+	 * frame has no paint to complete it. */
+	void Finish(uint64_t ts);
+
+	/* Recorder: drops the recording */
+	void Reset();
+
+	inline State GetState() const { return state.load(std::memory_order_acquire); }
+	inline bool Complete() const { return GetState() == State::Complete; }
+
+	/* Any thread: whether a recording has reached its duration at ts,
+	 * and only waits for Finish */
+	inline bool Due(uint64_t ts) const
+	{
+		return GetState() == State::Recording && ts >= end_ts.load(std::memory_order_relaxed);
+	}
+
+	/* Player: moves the current frame to the one shown at time t since
+	 * the start of the replay, wrapping around at the end of the loop.
+	 * Returns false if the frame did not change, otherwise the changed
+	 * regions are returned in rects, or full is set if the whole frame
+	 * has to be uploaded. */
+	bool Seek(uint64_t t, std::vector<FrameRect> &rects, bool &full);
+
+	/* Player: the current frame, cx * 4 bytes per row */
+	inline const uint8_t *Data() const { return current.data(); }
+	inline uint32_t Width() const { return cx; }
+	inline uint32_t Height() const { return cy; }
+
+	inline size_t Frames() const { return loop_frames.size() + (keyframe.empty() ? 0 : 1); }
+	inline size_t Bytes() const { return keyframe.size() + pixels.size() + current.size(); }
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/* Layout of the POSIX shared memory object ("/dev/shm/obs-browser-<name>")
+ * that a browser source publishes its CPU painted frames to.  Shared with
+ * external readers, so only ever extend it together with the version.
+ *
+ * The writer never waits for readers.  Frame n (counting from 1) goes to
+ * slot n % slot_count, and each slot is guarded by a sequence lock that is
+ * odd while the slot is being written.  To read the newest frame:
+ *
+ *   1. n = latest_seq (acquire), 0 means no frame was published yet
+ *   2. lock = slots[n % slot_count].lock (acquire), retry if odd
+ *   3. copy the slot fields and the frame data
+ *   4. acquire fence, then reload the lock; if it changed or the slot's
+ *      seq is not n, the writer lapped the reader and the copy is torn
+ *
+ * Readers that fall behind simply skip to the newest frame.  When the frame
+ * size outgrows the slots the writer sets closed, unlinks the object and
+ * creates a new one under the same name; readers have to reopen it. */
+
+#define BROWSER_SHM_MAGIC 0x4d485342 /* "BSHM" */
+#define BROWSER_SHM_VERSION 1
+#define BROWSER_SHM_SLOTS 3
+
+enum BrowserShmFormat : uint32_t {
+	BROWSER_SHM_FORMAT_BGRA = 1,
+	BROWSER_SHM_FORMAT_BGRX = 2,
+};
+
+struct BrowserShmSlot {
+	std::atomic<uint64_t> lock;
+	uint64_t seq;
+	/* os_gettime_ns() when the frame was painted */
+	uint64_t timestamp;
+	uint32_t cx;
+	uint32_t cy;
+	uint32_t linesize;
+	uint32_t format;
+};
+
+struct BrowserShmHeader {
+	uint32_t magic;
+	uint32_t version;
+	std::atomic<uint32_t> closed;
+	uint32_t slot_count;
+	/* frame data of slot i starts at data_offset + i * slot_size bytes
+	 * from the start of the object */
+	uint64_t slot_size;
+	uint64_t data_offset;
+	std::atomic<uint64_t> latest_seq;
+	BrowserShmSlot slots[BROWSER_SHM_SLOTS];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory atomics must be lock-free");
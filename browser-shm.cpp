@@ -0,0 +1,126 @@
+#include "browser-shm.hpp"
+
+#include <util/base.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SHM_DATA_ALIGN 64
+
+static inline size_t AlignSize(size_t size)
+{
+	return (size + SHM_DATA_ALIGN - 1) & ~(size_t)(SHM_DATA_ALIGN - 1);
+}
+
+ShmFrameExport::ShmFrameExport(std::string name_) : name(std::move(name_)) {}
+
+ShmFrameExport::~ShmFrameExport()
+{
+	Unmap();
+}
+
+void ShmFrameExport::Unmap()
+{
+	if (map) {
+		BrowserShmHeader *header = (BrowserShmHeader *)map;
+		header->closed.store(1, std::memory_order_release);
+		munmap(map, map_size);
+		map = nullptr;
+		map_size = 0;
+	}
+	if (fd != -1) {
+		close(fd);
+		shm_unlink(name.c_str());
+		fd = -1;
+	}
+}
+
+bool ShmFrameExport::Map(size_t slot_size)
+{
+	Unmap();
+
+	fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd == -1 && errno == EEXIST) {
+		/* left behind by a crash */
+		shm_unlink(name.c_str());
+		fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	}
+	if (fd == -1) {
+		blog(LOG_WARNING, "[obs-browser]: Failed to create shared memory '%s': %s", name.c_str(),
+		     strerror(errno));
+		return false;
+	}
+
+	const size_t data_offset = AlignSize(sizeof(BrowserShmHeader));
+	slot_size = AlignSize(slot_size);
+	const size_t size = data_offset + slot_size * BROWSER_SHM_SLOTS;
+
+	void *ptr = MAP_FAILED;
+	if (ftruncate(fd, (off_t)size) == 0)
+		ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ptr == MAP_FAILED) {
+		blog(LOG_WARNING, "[obs-browser]: Failed to map %zu bytes of shared memory '%s': %s", size,
+		     name.c_str(), strerror(errno));
+		Unmap();
+		return false;
+	}
+
+	map = (uint8_t *)ptr;
+	map_size = size;
+
+	/* the object is zeroed, so latest_seq tells readers there is no
+	 * frame yet */
+	BrowserShmHeader *header = (BrowserShmHeader *)map;
+	header->magic = BROWSER_SHM_MAGIC;
+	header->version = BROWSER_SHM_VERSION;
+	header->slot_count = BROWSER_SHM_SLOTS;
+	header->slot_size = slot_size;
+	header->data_offset = data_offset;
+	return true;
+}
+
+void ShmFrameExport::Publish(const uint8_t *data, uint32_t linesize, uint32_t cx, uint32_t cy, bool opaque,
+			     uint64_t ts)
+{
+	if (failed)
+		return;
+
+	const size_t row_size = (size_t)cx * 4;
+	const size_t frame_size = row_size * cy;
+
+	BrowserShmHeader *header = (BrowserShmHeader *)map;
+	if (!map || header->slot_size < frame_size) {
+		if (!Map(frame_size)) {
+			failed = true;
+			return;
+		}
+		header = (BrowserShmHeader *)map;
+	}
+
+	seq++;
+	BrowserShmSlot &slot = header->slots[seq % BROWSER_SHM_SLOTS];
+	uint8_t *dst = map + header->data_offset + (seq % BROWSER_SHM_SLOTS) * header->slot_size;
+
+	const uint64_t lock = slot.lock.load(std::memory_order_relaxed);
+	slot.lock.store(lock + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot.seq = seq;
+	slot.timestamp = ts;
+	slot.cx = cx;
+	slot.cy = cy;
+	slot.linesize = (uint32_t)row_size;
+	slot.format = opaque ? BROWSER_SHM_FORMAT_BGRX : BROWSER_SHM_FORMAT_BGRA;
+
+	if (linesize == row_size) {
+		memcpy(dst, data, frame_size);
+	} else {
+		for (uint32_t y = 0; y < cy; y++)
+			memcpy(dst + y * row_size, data + (size_t)y * linesize, row_size);
+	}
+
+	slot.lock.store(lock + 2, std::memory_order_release);
+	header->latest_seq.store(seq, std::memory_order_release);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "browser-shm-protocol.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/* Publishes CPU painted frames to a shared memory ring for external
+ * processes, see browser-shm-protocol.hpp.  Only used on the CEF UI
+ * thread; publishing copies the frame and never blocks. */
+class ShmFrameExport {
+	std::string name;
+	int fd = -1;
+	uint8_t *map = nullptr;
+	size_t map_size = 0;
+	uint64_t seq = 0;
+	bool failed = false;
+
+	bool Map(size_t slot_size);
+	void Unmap();
+
+public:
+	/* name is the shared memory object name, starting with a slash */
+	explicit ShmFrameExport(std::string name);
+	~ShmFrameExport();
+
+	void Publish(const uint8_t *data, uint32_t linesize, uint32_t cx, uint32_t cy, bool opaque, uint64_t ts);
+
+	inline const std::string &Name() const { return name; }
+};
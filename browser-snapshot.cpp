@@ -0,0 +1,157 @@
+#include "browser-snapshot.hpp"
+
+#include <util/platform.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <QBuffer>
+#include <QImage>
+#include <QImageWriter>
+
+#define SNAPSHOT_WORKERS 2
+
+bool ParseSnapshotFormat(const char *name, SnapshotFormat &format)
+{
+	if (!name || !*name || strcmp(name, "png") == 0)
+		format = SnapshotFormat::Png;
+	else if (strcmp(name, "webp") == 0)
+		format = SnapshotFormat::WebP;
+	else if (strcmp(name, "raw") == 0)
+		format = SnapshotFormat::Raw;
+	else
+		return false;
+	return true;
+}
+
+bool EncodeFrameSnapshot(const FrameSnapshot &snapshot, SnapshotFormat format, int quality, std::string &out,
+			 std::string &error)
+{
+	if (format == SnapshotFormat::Raw) {
+		const size_t size = snapshot.data.size();
+		out.resize(size);
+
+		const uint8_t *src = snapshot.data.data();
+		uint8_t *dst = (uint8_t *)&out[0];
+		for (size_t i = 0; i < size; i += 4) {
+			dst[i + 0] = src[i + 2];
+			dst[i + 1] = src[i + 1];
+			dst[i + 2] = src[i + 0];
+			dst[i + 3] = src[i + 3];
+		}
+		return true;
+	}
+
+	const char *qt_format = format == SnapshotFormat::Png ? "png" : "webp";
+	if (!QImageWriter::supportedImageFormats().contains(qt_format)) {
+		error = std::string("Image format not supported: ") + qt_format;
+		return false;
+	}
+
+	/* BGRA in memory is what Qt calls ARGB32 on little endian */
+	const QImage image(snapshot.data.data(), (int)snapshot.cx, (int)snapshot.cy, (int)snapshot.cx * 4,
+			   QImage::Format_ARGB32_Premultiplied);
+
+	QByteArray bytes;
+	QBuffer buffer(&bytes);
+	buffer.open(QIODevice::WriteOnly);
+	if (!image.save(&buffer, qt_format, quality)) {
+		error = "Failed to encode the frame";
+		return false;
+	}
+
+	out.assign(bytes.constData(), (size_t)bytes.size());
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static std::mutex worker_mutex;
+static std::condition_variable worker_cv;
+static std::deque<std::function<void()>> jobs;
+static std::vector<std::thread> workers;
+static size_t jobs_in_flight = 0;
+static bool workers_stop = false;
+
+static std::atomic<uint64_t> snapshots_encoded = 0;
+static std::atomic<uint64_t> snapshots_refused = 0;
+static std::atomic<uint64_t> snapshot_bytes = 0;
+static std::atomic<uint64_t> snapshot_encode_ns = 0;
+
+static void SnapshotWorkerThread()
+{
+	os_set_thread_name("obs-browser: snapshot worker");
+
+	std::unique_lock<std::mutex> lock(worker_mutex);
+
+	while (!workers_stop) {
+		if (jobs.empty()) {
+			worker_cv.wait(lock);
+			continue;
+		}
+
+		std::function<void()> job = std::move(jobs.front());
+		jobs.pop_front();
+
+		lock.unlock();
+		job();
+		lock.lock();
+
+		jobs_in_flight--;
+	}
+}
+
+bool QueueSnapshotJob(std::function<void()> job)
+{
+	std::lock_guard<std::mutex> lock(worker_mutex);
+
+	if (workers_stop || jobs_in_flight == SNAPSHOT_MAX_JOBS) {
+		snapshots_refused++;
+		return false;
+	}
+
+	while (workers.size() < SNAPSHOT_WORKERS)
+		workers.emplace_back(SnapshotWorkerThread);
+
+	jobs_in_flight++;
+	jobs.push_back(std::move(job));
+	worker_cv.notify_one();
+	return true;
+}
+
+void StopSnapshotWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(worker_mutex);
+		workers_stop = true;
+		worker_cv.notify_all();
+	}
+
+	for (std::thread &worker : workers)
+		worker.join();
+	workers.clear();
+
+	/* jobs own promises, dropping them fails the requests still
+	 * waiting on them */
+	jobs.clear();
+}
+
+void RecordFrameSnapshot(uint64_t encode_ns, size_t bytes)
+{
+	snapshots_encoded++;
+	snapshot_bytes += bytes;
+	snapshot_encode_ns += encode_ns;
+}
+
+void GetFrameSnapshotStats(obs_data_t *data)
+{
+	const uint64_t encoded = snapshots_encoded;
+
+	obs_data_set_int(data, "snapshots_encoded", (long long)encoded);
+	obs_data_set_int(data, "snapshots_refused", (long long)snapshots_refused);
+	obs_data_set_int(data, "snapshot_bytes", (long long)snapshot_bytes);
+	obs_data_set_int(data, "snapshot_encode_ns", encoded ? (long long)(snapshot_encode_ns / encoded) : 0);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <obs-module.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/* Frame copied out of the CPU paint buffer for a get_frame_snapshot
+ * request, tightly packed premultiplied BGRA */
+struct FrameSnapshot {
+	std::vector<uint8_t> data;
+	uint32_t cx = 0;
+	uint32_t cy = 0;
+	uint64_t timestamp = 0;
+};
+
+enum class SnapshotFormat {
+	Raw,
+	Png,
+	WebP,
+};
+
+bool ParseSnapshotFormat(const char *name, SnapshotFormat &format);
+
+/* Encodes a snapshot, raw frames as RGBA.  Returns false and sets error if
+ * Qt has no writer for the format. */
+bool EncodeFrameSnapshot(const FrameSnapshot &snapshot, SnapshotFormat format, int quality, std::string &out,
+			 std::string &error);
+
+/* Runs a job on the snapshot worker threads, started on first use.  At most
+ * SNAPSHOT_MAX_JOBS jobs are queued or running at once; beyond that the job
+ * is refused and false returned. */
+#define SNAPSHOT_MAX_JOBS 8
+
+/* How long a request waits for the browser to paint a frame */
+#define SNAPSHOT_TIMEOUT_MS 1000
+bool QueueSnapshotJob(std::function<void()> job);
+
+void StopSnapshotWorkers();
+
+/* Records a finished request, for GetFrameSnapshotStats */
+void RecordFrameSnapshot(uint64_t encode_ns, size_t bytes);
+
+void GetFrameSnapshotStats(obs_data_t *data);
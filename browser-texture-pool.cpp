@@ -0,0 +1,148 @@
+#include "browser-texture-pool.hpp"
+
+#include <util/platform.h>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+/* Idle textures older than this are destroyed */
+#define POOL_IDLE_TIMEOUT_NS 10000000000ULL
+/* Memory cap for idle textures */
+#define POOL_MAX_IDLE_BYTES (256ULL * 1024 * 1024)
+#define POOL_TRIM_INTERVAL_NS 1000000000ULL
+
+struct PoolKey {
+	uint32_t cx;
+	uint32_t cy;
+	enum gs_color_format format;
+	uint32_t flags;
+
+	inline bool operator==(const PoolKey &other) const
+	{
+		return cx == other.cx && cy == other.cy && format == other.format && flags == other.flags;
+	}
+};
+
+struct IdleTexture {
+	gs_texture_t *tex;
+	PoolKey key;
+	uint64_t released_ts;
+	size_t size;
+};
+
+/* Protected by the graphics context */
+static std::vector<IdleTexture> idle_textures;
+static std::unordered_map<gs_texture_t *, PoolKey> used_textures;
+static size_t idle_bytes = 0;
+static uint64_t last_trim_ts = 0;
+
+static std::atomic<uint64_t> pool_hits = 0;
+static std::atomic<uint64_t> pool_misses = 0;
+static std::atomic<uint64_t> pool_evictions = 0;
+static std::atomic<uint64_t> pool_idle_bytes = 0;
+static std::atomic<uint64_t> pool_idle_count = 0;
+
+static inline size_t TextureSize(const PoolKey &key)
+{
+	return (size_t)key.cx * key.cy * gs_get_format_bpp(key.format) / 8;
+}
+
+static inline void UpdateIdleStats()
+{
+	pool_idle_bytes = idle_bytes;
+	pool_idle_count = idle_textures.size();
+}
+
+static void EvictIdleTexture(size_t idx)
+{
+	gs_texture_destroy(idle_textures[idx].tex);
+	idle_bytes -= idle_textures[idx].size;
+	idle_textures.erase(idle_textures.begin() + idx);
+	pool_evictions++;
+}
+
+gs_texture_t *AcquirePooledTexture(uint32_t cx, uint32_t cy, enum gs_color_format format, uint32_t flags)
+{
+	const PoolKey key = {cx, cy, format, flags};
+
+	/* most recently released first */
+	for (size_t i = idle_textures.size(); i > 0; i--) {
+		IdleTexture &idle = idle_textures[i - 1];
+		if (!(idle.key == key))
+			continue;
+
+		gs_texture_t *tex = idle.tex;
+		idle_bytes -= idle.size;
+		idle_textures.erase(idle_textures.begin() + (i - 1));
+		used_textures[tex] = key;
+
+		pool_hits++;
+		UpdateIdleStats();
+		return tex;
+	}
+
+	gs_texture_t *tex = gs_texture_create(cx, cy, format, 1, nullptr, flags);
+	if (tex)
+		used_textures[tex] = key;
+
+	pool_misses++;
+	return tex;
+}
+
+void ReleasePooledTexture(gs_texture_t *tex)
+{
+	if (!tex)
+		return;
+
+	auto it = used_textures.find(tex);
+	if (it == used_textures.end()) {
+		gs_texture_destroy(tex);
+		return;
+	}
+
+	IdleTexture idle;
+	idle.tex = tex;
+	idle.key = it->second;
+	idle.released_ts = os_gettime_ns();
+	idle.size = TextureSize(idle.key);
+	used_textures.erase(it);
+
+	idle_textures.push_back(idle);
+	idle_bytes += idle.size;
+
+	while (idle_bytes > POOL_MAX_IDLE_BYTES && !idle_textures.empty())
+		EvictIdleTexture(0);
+
+	UpdateIdleStats();
+}
+
+void TrimTexturePool()
+{
+	const uint64_t now = os_gettime_ns();
+	if (now - last_trim_ts < POOL_TRIM_INTERVAL_NS)
+		return;
+	last_trim_ts = now;
+
+	/* ordered by release time, oldest first */
+	while (!idle_textures.empty() && now - idle_textures[0].released_ts > POOL_IDLE_TIMEOUT_NS)
+		EvictIdleTexture(0);
+
+	UpdateIdleStats();
+}
+
+void FreeTexturePool()
+{
+	while (!idle_textures.empty())
+		EvictIdleTexture(idle_textures.size() - 1);
+
+	UpdateIdleStats();
+}
+
+void GetTexturePoolStats(obs_data_t *data)
+{
+	obs_data_set_int(data, "hits", (long long)pool_hits);
+	obs_data_set_int(data, "misses", (long long)pool_misses);
+	obs_data_set_int(data, "evictions", (long long)pool_evictions);
+	obs_data_set_int(data, "idle_textures", (long long)pool_idle_count);
+	obs_data_set_int(data, "idle_bytes", (long long)pool_idle_bytes);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <obs-module.h>
+
+/* Module-wide pool of textures shared by all browser sources, so that scene
+ * switches and resizing reuse GPU allocations instead of churning them.
+ * Released textures are kept for a while, bounded by a memory cap.
+ *
+ * All functions must be called with the graphics context entered. */
+
+gs_texture_t *AcquirePooledTexture(uint32_t cx, uint32_t cy, enum gs_color_format format, uint32_t flags);
+
+/* Returns a texture to the pool.  Textures that did not come from the pool
+ * (e.g. shared textures opened from a handle) are destroyed. */
+void ReleasePooledTexture(gs_texture_t *tex);
+
+/* Destroys textures that have been idle for too long */
+void TrimTexturePool();
+
+/* Destroys all idle textures */
+void FreeTexturePool();
+
+void GetTexturePoolStats(obs_data_t *data);
@@ -0,0 +1,19 @@
+add_executable(obs-browser-test)
+
+target_sources(
+  obs-browser-test
+  PRIVATE # cmake-format: sortable
+          browser-convert.cpp browser-convert.hpp browser-frame-hash.cpp browser-frame-hash.hpp browser-frame.cpp
+          browser-frame.hpp browser-loop.cpp browser-loop.hpp browser-snapshot.cpp browser-snapshot.hpp
+          obs-browser-test/obs-browser-test.cpp)
+
+if(OS_LINUX)
+  target_sources(obs-browser-test PRIVATE browser-dmabuf-cache.cpp browser-dmabuf-cache.hpp)
+endif()
+
+target_compile_features(obs-browser-test PRIVATE cxx_std_17)
+target_link_libraries(obs-browser-test PRIVATE OBS::libobs Qt::Gui)
+
+set_target_properties(obs-browser-test PROPERTIES FOLDER plugins/obs-browser)
+
+add_test(NAME obs-browser-test COMMAND obs-browser-test)
@@ -7,7 +7,19 @@ target_include_directories(obs-browser PRIVATE ${libdrm_include_directories})
 target_link_libraries(obs-browser PRIVATE CEF::Wrapper CEF::Library X11::X11)
 set_target_properties(obs-browser PROPERTIES BUILD_RPATH "$ORIGIN/" INSTALL_RPATH "$ORIGIN/")
 
-target_sources(obs-browser PRIVATE drm-format.cpp drm-format.hpp)
+target_sources(
+  obs-browser
+  PRIVATE # cmake-format: sortable
+          browser-cpu-governor.cpp
+          browser-cpu-governor.hpp
+          browser-dmabuf-cache.cpp
+          browser-dmabuf-cache.hpp
+          browser-shm-protocol.hpp
+          browser-shm.cpp
+          browser-shm.hpp
+          drm-format.cpp
+          drm-format.hpp)
+target_link_libraries(obs-browser PRIVATE rt)
 
 add_executable(browser-helper)
 add_executable(OBS::browser-helper ALIAS browser-helper)
@@ -32,3 +44,30 @@ set_target_properties_obs(
              PREFIX ""
              OUTPUT_NAME obs-browser-page)
 # cmake-format: on
+
+add_executable(obs-browser-shm-reader)
+
+target_sources(obs-browser-shm-reader PRIVATE browser-shm-protocol.hpp
+                                              obs-browser-shm-reader/obs-browser-shm-reader.cpp)
+target_compile_features(obs-browser-shm-reader PRIVATE cxx_std_17)
+target_link_libraries(obs-browser-shm-reader PRIVATE rt)
+
+set_target_properties(obs-browser-shm-reader PROPERTIES FOLDER plugins/obs-browser)
+
+add_executable(obs-browser-render)
+
+target_sources(obs-browser-render PRIVATE browser-app.cpp browser-app.hpp cef-headers.hpp
+                                          obs-browser-render/obs-browser-render.cpp)
+
+target_include_directories(obs-browser-render PRIVATE "${CMAKE_CURRENT_SOURCE_DIR}/deps")
+
+target_link_libraries(obs-browser-render PRIVATE CEF::Wrapper CEF::Library)
+
+# cmake-format: off
+set_target_properties_obs(
+  obs-browser-render
+  PROPERTIES FOLDER plugins/obs-browser
+             BUILD_RPATH "$ORIGIN/"
+             INSTALL_RPATH "$ORIGIN/"
+             PREFIX "")
+# cmake-format: on
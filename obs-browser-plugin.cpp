@@ -23,7 +23,9 @@
 #include <util/dstr.hpp>
 #include <obs-module.h>
 #include <obs.hpp>
+#include <chrono>
 #include <functional>
+#include <future>
 #include <sstream>
 #include <thread>
 #include <mutex>
@@ -31,9 +33,12 @@
 #include <obs-websocket-api.h>
 
 #include "obs-browser-source.hpp"
+#include "browser-texture-pool.hpp"
 #include "browser-scheme.hpp"
+#include "browser-snapshot.hpp"
 #include "browser-app.hpp"
 #include "browser-version.h"
+#include "base64/base64.hpp"
 
 #include "cef-headers.hpp"
 
@@ -56,6 +61,7 @@
 #endif
 
 #if !defined(_WIN32) && !defined(__APPLE__)
+#include "browser-cpu-governor.hpp"
 #include "drm-format.hpp"
 #endif
 
@@ -136,6 +142,27 @@ static void browser_source_get_defaults(obs_data_t *settings)
 	obs_data_set_default_int(settings, "webpage_control_level", (int)DEFAULT_CONTROL_LEVEL);
 	obs_data_set_default_string(settings, "css", default_css);
 	obs_data_set_default_bool(settings, "reroute_audio", false);
+	obs_data_set_default_bool(settings, "skip_duplicate_frames", false);
+	obs_data_set_default_bool(settings, "match_displayed_size", false);
+	obs_data_set_default_bool(settings, "opaque", false);
+	obs_data_set_default_bool(settings, "snapshot", false);
+	obs_data_set_default_int(settings, "snapshot_delay", 2000);
+	obs_data_set_default_bool(settings, "loop_capture", false);
+	obs_data_set_default_int(settings, "loop_duration", 5000);
+	obs_data_set_default_int(settings, "loop_memory_cap", 256);
+	obs_data_set_default_bool(settings, "async_video", false);
+	obs_data_set_default_bool(settings, "shm_export", false);
+	obs_data_set_default_bool(settings, "begin_frame_sync", false);
+	obs_data_set_default_bool(settings, "begin_frame_low_latency", false);
+	obs_data_set_default_int(settings, "idle_timeout", 0);
+	obs_data_set_default_int(settings, "idle_fps", 1);
+	obs_data_set_default_int(settings, "frame_rate_policy", (int)FrameRatePolicy::Global);
+	obs_data_set_default_int(settings, "preview_fps", 15);
+	obs_data_set_default_int(settings, "hidden_fps", 1);
+	obs_data_set_default_bool(settings, "interaction_boost", true);
+#if !defined(_WIN32) && !defined(__APPLE__)
+	obs_data_set_default_int(settings, "cpu_priority", (int)CpuPriority::Normal);
+#endif
 }
 
 static bool is_local_file_modified(obs_properties_t *props, obs_property_t *, obs_data_t *settings)
@@ -158,6 +185,52 @@ static bool is_fps_custom(obs_properties_t *props, obs_property_t *, obs_data_t
 	return true;
 }
 
+static bool is_snapshot(obs_properties_t *props, obs_property_t *, obs_data_t *settings)
+{
+	bool enabled = obs_data_get_bool(settings, "snapshot");
+	obs_property_t *delay = obs_properties_get(props, "snapshot_delay");
+	obs_property_set_visible(delay, enabled);
+
+	return true;
+}
+
+static bool is_loop_capture(obs_properties_t *props, obs_property_t *, obs_data_t *settings)
+{
+	bool enabled = obs_data_get_bool(settings, "loop_capture");
+	obs_property_set_visible(obs_properties_get(props, "loop_duration"), enabled);
+	obs_property_set_visible(obs_properties_get(props, "loop_memory_cap"), enabled);
+	obs_property_set_visible(obs_properties_get(props, "loop_recapture"), enabled);
+
+	return true;
+}
+
+static bool is_begin_frame_sync(obs_properties_t *props, obs_property_t *, obs_data_t *settings)
+{
+	bool enabled = obs_data_get_bool(settings, "begin_frame_sync");
+	obs_property_t *low_latency = obs_properties_get(props, "begin_frame_low_latency");
+	obs_property_set_visible(low_latency, enabled);
+
+	return true;
+}
+
+static bool is_idle_governed(obs_properties_t *props, obs_property_t *, obs_data_t *settings)
+{
+	bool enabled = obs_data_get_int(settings, "idle_timeout") > 0;
+	obs_property_t *idle_fps = obs_properties_get(props, "idle_fps");
+	obs_property_set_visible(idle_fps, enabled);
+
+	return true;
+}
+
+static bool is_frame_rate_policy_custom(obs_properties_t *props, obs_property_t *, obs_data_t *settings)
+{
+	bool enabled = obs_data_get_int(settings, "frame_rate_policy") == (int)FrameRatePolicy::Custom;
+	obs_property_set_visible(obs_properties_get(props, "preview_fps"), enabled);
+	obs_property_set_visible(obs_properties_get(props, "hidden_fps"), enabled);
+
+	return true;
+}
+
 static obs_properties_t *browser_source_get_properties(void *data)
 {
 	obs_properties_t *props = obs_properties_create();
@@ -199,6 +272,67 @@ static obs_properties_t *browser_source_get_properties(void *data)
 	obs_property_text_set_monospace(p, true);
 	obs_properties_add_bool(props, "shutdown", obs_module_text("ShutdownSourceNotVisible"));
 	obs_properties_add_bool(props, "restart_when_active", obs_module_text("RefreshBrowserActive"));
+	obs_properties_add_bool(props, "opaque", obs_module_text("OpaquePage"));
+	obs_properties_add_bool(props, "skip_duplicate_frames", obs_module_text("SkipDuplicateFrames"));
+
+	obs_property_t *idle_timeout =
+		obs_properties_add_int(props, "idle_timeout", obs_module_text("IdleTimeout"), 0, 3600, 1);
+	obs_property_int_set_suffix(idle_timeout, " s");
+	obs_property_set_long_description(idle_timeout, obs_module_text("IdleTimeout.Description"));
+	obs_property_set_modified_callback(idle_timeout, is_idle_governed);
+	obs_properties_add_int(props, "idle_fps", obs_module_text("IdleFPS"), 1, 30, 1);
+
+	obs_property_t *frame_rate_policy = obs_properties_add_list(props, "frame_rate_policy",
+								    obs_module_text("FrameRatePolicy"),
+								    OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(frame_rate_policy, obs_module_text("FrameRatePolicy.Global"),
+				  (int)FrameRatePolicy::Global);
+	obs_property_list_add_int(frame_rate_policy, obs_module_text("FrameRatePolicy.Full"),
+				  (int)FrameRatePolicy::Full);
+	obs_property_list_add_int(frame_rate_policy, obs_module_text("FrameRatePolicy.Custom"),
+				  (int)FrameRatePolicy::Custom);
+	obs_property_set_modified_callback(frame_rate_policy, is_frame_rate_policy_custom);
+	obs_properties_add_int(props, "preview_fps", obs_module_text("PreviewFPS"), 1, 60, 1);
+	obs_properties_add_int(props, "hidden_fps", obs_module_text("HiddenFPS"), 1, 60, 1);
+	obs_properties_add_bool(props, "interaction_boost", obs_module_text("InteractionBoost"));
+#if !defined(_WIN32) && !defined(__APPLE__)
+	obs_property_t *cpu_priority = obs_properties_add_list(props, "cpu_priority", obs_module_text("CpuPriority"),
+							       OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(cpu_priority, obs_module_text("CpuPriority.Low"), (int)CpuPriority::Low);
+	obs_property_list_add_int(cpu_priority, obs_module_text("CpuPriority.Normal"), (int)CpuPriority::Normal);
+	obs_property_list_add_int(cpu_priority, obs_module_text("CpuPriority.High"), (int)CpuPriority::High);
+	obs_property_set_long_description(cpu_priority, obs_module_text("CpuPriority.Description"));
+#endif
+
+	obs_property_t *snapshot = obs_properties_add_bool(props, "snapshot", obs_module_text("Snapshot"));
+	obs_property_set_modified_callback(snapshot, is_snapshot);
+	obs_property_t *snapshot_delay = obs_properties_add_int(props, "snapshot_delay",
+								 obs_module_text("SnapshotDelay"), 0, 60000, 100);
+	obs_property_int_set_suffix(snapshot_delay, " ms");
+
+	obs_property_t *loop = obs_properties_add_bool(props, "loop_capture", obs_module_text("LoopCapture"));
+	obs_property_set_modified_callback(loop, is_loop_capture);
+	obs_property_t *loop_duration = obs_properties_add_int(props, "loop_duration", obs_module_text("LoopDuration"),
+								100, 60000, 100);
+	obs_property_int_set_suffix(loop_duration, " ms");
+	obs_property_t *loop_memory_cap = obs_properties_add_int(props, "loop_memory_cap",
+								  obs_module_text("LoopMemoryCap"), 16, 4096, 16);
+	obs_property_int_set_suffix(loop_memory_cap, " MB");
+	obs_properties_add_button(props, "loop_recapture", obs_module_text("LoopRecapture"),
+				  [](obs_properties_t *, obs_property_t *, void *data) {
+					  static_cast<BrowserSource *>(data)->Refresh();
+					  return false;
+				  });
+
+	obs_properties_add_bool(props, "match_displayed_size", obs_module_text("MatchDisplayedSize"));
+	obs_properties_add_bool(props, "async_video", obs_module_text("AsyncVideo"));
+	obs_property_t *begin_frame_sync =
+		obs_properties_add_bool(props, "begin_frame_sync", obs_module_text("BeginFrameSync"));
+	obs_property_set_modified_callback(begin_frame_sync, is_begin_frame_sync);
+	obs_properties_add_bool(props, "begin_frame_low_latency", obs_module_text("BeginFrameLowLatency"));
+#if !defined(_WIN32) && !defined(__APPLE__)
+	obs_properties_add_bool(props, "shm_export", obs_module_text("ShmExport"));
+#endif
 
 	obs_property_t *controlLevel = obs_properties_add_list(props, "webpage_control_level",
 							       obs_module_text("WebpageControlLevel"),
@@ -225,6 +359,16 @@ static obs_properties_t *browser_source_get_properties(void *data)
 	return props;
 }
 
+static void browser_tick(void *, float)
+{
+	SendBeginFrames();
+
+	/* idle textures expire even when no browser source is rendered */
+	obs_enter_graphics();
+	TrimTexturePool();
+	obs_leave_graphics();
+}
+
 static void missing_file_callback(void *src, const char *new_path, void *data)
 {
 	BrowserSource *bs = static_cast<BrowserSource *>(src);
@@ -478,14 +622,14 @@ void RegisterBrowserSource()
 	info.video_render = [](void *data, gs_effect_t *) {
 		static_cast<BrowserSource *>(data)->Render();
 	};
+	info.enum_active_sources = [](void *data, obs_source_enum_proc_t cb, void *param) {
+		static_cast<BrowserSource *>(data)->EnumActiveSources(cb, param);
+	};
 #if CHROME_VERSION_BUILD < 4103
 	info.audio_mix = [](void *data, uint64_t *ts_out, struct audio_output_data *audio_output, size_t channels,
 			    size_t sample_rate) {
 		return static_cast<BrowserSource *>(data)->AudioMix(ts_out, audio_output, channels, sample_rate);
 	};
-	info.enum_active_sources = [](void *data, obs_source_enum_proc_t cb, void *param) {
-		static_cast<BrowserSource *>(data)->EnumAudioStreams(cb, param);
-	};
 #endif
 	info.mouse_click = [](void *data, const struct obs_mouse_event *event, int32_t type, bool mouse_up,
 			      uint32_t click_count) {
@@ -520,6 +664,22 @@ void RegisterBrowserSource()
 	};
 
 	obs_register_source(&info);
+
+	/* private child of a browser source in async video mode, holding
+	 * the frames libobs buffers for it */
+	struct obs_source_info video_info = {};
+	video_info.id = "browser_source_video";
+	video_info.type = OBS_SOURCE_TYPE_INPUT;
+	video_info.output_flags = OBS_SOURCE_ASYNC_VIDEO | OBS_SOURCE_DO_NOT_DUPLICATE | OBS_SOURCE_CAP_DISABLED;
+	video_info.get_name = [](void *) {
+		return obs_module_text("BrowserSource");
+	};
+	video_info.create = [](obs_data_t *, obs_source_t *source) -> void * {
+		return source;
+	};
+	video_info.destroy = [](void *) {};
+
+	obs_register_source(&video_info);
 }
 
 /* ========================================================================= */
@@ -737,6 +897,53 @@ static void check_hwaccel_support(void)
 #endif
 #endif
 
+static void LoadFrameRatePolicy()
+{
+	BPtr<char> path = obs_module_config_path("frame-rate-policy.json");
+	OBSDataAutoRelease policy = obs_data_create_from_json_file(path);
+	if (policy)
+		SetFrameRatePolicy(policy);
+}
+
+static void SaveFrameRatePolicy()
+{
+	BPtr<char> conf_path = obs_module_config_path("");
+	os_mkdirs(conf_path);
+
+	OBSDataAutoRelease policy = obs_data_create();
+	GetFrameRatePolicy(policy);
+
+	BPtr<char> path = obs_module_config_path("frame-rate-policy.json");
+	if (!obs_data_save_json_safe(policy, path, "tmp", "bak"))
+		blog(LOG_WARNING, "[obs-browser]: Failed to save the frame rate policy");
+}
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+static void LoadCpuGovernor()
+{
+	BPtr<char> path = obs_module_config_path("cpu-governor.json");
+	OBSDataAutoRelease governor = obs_data_create_from_json_file(path);
+	if (governor)
+		SetCpuGovernor(governor);
+}
+
+static void SaveCpuGovernor()
+{
+	BPtr<char> conf_path = obs_module_config_path("");
+	os_mkdirs(conf_path);
+
+	OBSDataAutoRelease governor = obs_data_create();
+	GetCpuGovernor(governor);
+	obs_data_erase(governor, "usage");
+	obs_data_erase(governor, "sources");
+	obs_data_erase(governor, "decisions");
+
+	BPtr<char> path = obs_module_config_path("cpu-governor.json");
+	if (!obs_data_save_json_safe(governor, path, "tmp", "bak"))
+		blog(LOG_WARNING, "[obs-browser]: Failed to save the CPU governor budget");
+}
+#endif
+
 bool obs_module_load(void)
 {
 #ifdef ENABLE_BROWSER_QT_LOOP
@@ -765,7 +972,13 @@ bool obs_module_load(void)
 	     cef_version_info(5), cef_version_info(6), cef_version_info(7), CEF_VERSION);
 
 	RegisterBrowserSource();
+	LoadFrameRatePolicy();
+#if !defined(_WIN32) && !defined(__APPLE__)
+	LoadCpuGovernor();
+	StartCpuGovernor();
+#endif
 	obs_frontend_add_event_callback(handle_obs_frontend_event, nullptr);
+	obs_add_tick_callback(browser_tick, nullptr);
 
 #ifdef ENABLE_BROWSER_SHARED_TEXTURE
 	OBSDataAutoRelease private_data = obs_get_private_data();
@@ -784,6 +997,21 @@ bool obs_module_load(void)
 	return true;
 }
 
+/* Looks up the browser source named by the source_name field of a vendor
+ * request, setting an error on the response if there is none */
+static OBSSourceAutoRelease GetRequestBrowserSource(obs_data_t *request_data, obs_data_t *response_data)
+{
+	const char *source_name = obs_data_get_string(request_data, "source_name");
+
+	OBSSourceAutoRelease source = obs_get_source_by_name(source_name);
+	if (!source || strcmp(obs_source_get_unversioned_id(source), "browser_source") != 0) {
+		obs_data_set_string(response_data, "error", "Browser source not found");
+		return nullptr;
+	}
+
+	return source;
+}
+
 void obs_module_post_load(void)
 {
 	auto vendor = obs_websocket_register_vendor("obs-browser");
@@ -803,10 +1031,174 @@ void obs_module_post_load(void)
 
 	if (!obs_websocket_vendor_register_request(vendor, "emit_event", emit_event_request_cb, nullptr))
 		blog(LOG_WARNING, "[obs-browser]: Failed to register obs-websocket request emit_event");
+
+	auto get_source_stats_request_cb = [](obs_data_t *request_data, obs_data_t *response_data, void *) {
+		OBSSourceAutoRelease source = GetRequestBrowserSource(request_data, response_data);
+		if (!source)
+			return;
+
+		static_cast<BrowserSource *>(obs_obj_get_data(source))->GetStats(response_data);
+	};
+
+	if (!obs_websocket_vendor_register_request(vendor, "get_source_stats", get_source_stats_request_cb, nullptr))
+		blog(LOG_WARNING, "[obs-browser]: Failed to register obs-websocket request get_source_stats");
+
+	auto get_texture_pool_stats_request_cb = [](obs_data_t *, obs_data_t *response_data, void *) {
+		GetTexturePoolStats(response_data);
+	};
+
+	if (!obs_websocket_vendor_register_request(vendor, "get_texture_pool_stats", get_texture_pool_stats_request_cb,
+						   nullptr))
+		blog(LOG_WARNING, "[obs-browser]: Failed to register obs-websocket request get_texture_pool_stats");
+
+	auto refresh_request_cb = [](obs_data_t *request_data, obs_data_t *response_data, void *) {
+		OBSSourceAutoRelease source = GetRequestBrowserSource(request_data, response_data);
+		if (!source)
+			return;
+
+		static_cast<BrowserSource *>(obs_obj_get_data(source))->Refresh();
+	};
+
+	if (!obs_websocket_vendor_register_request(vendor, "refresh", refresh_request_cb, nullptr))
+		blog(LOG_WARNING, "[obs-browser]: Failed to register obs-websocket request refresh");
+
+	/* runs on an obs-websocket thread; the UI thread only copies the
+	 * frame, and the encoding is done on the snapshot workers */
+	auto get_frame_snapshot_request_cb = [](obs_data_t *request_data, obs_data_t *response_data, void *) {
+		SnapshotFormat format;
+		if (!ParseSnapshotFormat(obs_data_get_string(request_data, "format"), format)) {
+			obs_data_set_string(response_data, "error", "Unknown format");
+			return;
+		}
+
+		OBSSourceAutoRelease source = GetRequestBrowserSource(request_data, response_data);
+		if (!source)
+			return;
+
+		BrowserSource *bs = static_cast<BrowserSource *>(obs_obj_get_data(source));
+		uint64_t request_id = 0;
+		std::future<std::shared_ptr<FrameSnapshot>> frame = bs->RequestFrameSnapshot(request_id);
+		if (!frame.valid()) {
+			obs_data_set_string(response_data, "error", "Source is not painted on the CPU");
+			return;
+		}
+		if (frame.wait_for(std::chrono::milliseconds(SNAPSHOT_TIMEOUT_MS)) != std::future_status::ready) {
+			bs->CancelFrameSnapshot(request_id);
+			obs_data_set_string(response_data, "error", "No frame was painted");
+			return;
+		}
+
+		struct Result {
+			std::string image_data;
+			std::string error;
+			uint64_t encode_ns = 0;
+		};
+
+		std::shared_ptr<FrameSnapshot> snapshot = frame.get();
+		if (!snapshot) {
+			obs_data_set_string(response_data, "error", "No frame to take a snapshot of");
+			return;
+		}
+		const int quality = obs_data_has_user_value(request_data, "quality")
+					    ? (int)obs_data_get_int(request_data, "quality")
+					    : -1;
+		auto promise = std::make_shared<std::promise<Result>>();
+		std::future<Result> result_future = promise->get_future();
+
+		bool queued = QueueSnapshotJob([snapshot, format, quality, promise]() {
+			Result result;
+			const uint64_t start_ns = os_gettime_ns();
+
+			std::string encoded;
+			if (EncodeFrameSnapshot(*snapshot, format, quality, encoded, result.error))
+				result.image_data = base64_encode(encoded);
+
+			result.encode_ns = os_gettime_ns() - start_ns;
+			RecordFrameSnapshot(result.encode_ns, encoded.size());
+			promise->set_value(std::move(result));
+		});
+		if (!queued) {
+			obs_data_set_string(response_data, "error", "Too many snapshot requests");
+			return;
+		}
+
+		Result result;
+		try {
+			result = result_future.get();
+		} catch (const std::future_error &) {
+			result.error = "Snapshot workers stopped";
+		}
+
+		if (!result.error.empty()) {
+			obs_data_set_string(response_data, "error", result.error.c_str());
+			return;
+		}
+
+		obs_data_set_string(response_data, "image_data", result.image_data.c_str());
+		obs_data_set_int(response_data, "width", snapshot->cx);
+		obs_data_set_int(response_data, "height", snapshot->cy);
+		obs_data_set_int(response_data, "timestamp", (long long)snapshot->timestamp);
+		obs_data_set_int(response_data, "encode_ns", (long long)result.encode_ns);
+	};
+
+	if (!obs_websocket_vendor_register_request(vendor, "get_frame_snapshot", get_frame_snapshot_request_cb,
+						   nullptr))
+		blog(LOG_WARNING, "[obs-browser]: Failed to register obs-websocket request get_frame_snapshot");
+
+	auto get_frame_snapshot_stats_request_cb = [](obs_data_t *, obs_data_t *response_data, void *) {
+		GetFrameSnapshotStats(response_data);
+	};
+
+	if (!obs_websocket_vendor_register_request(vendor, "get_frame_snapshot_stats",
+						   get_frame_snapshot_stats_request_cb, nullptr))
+		blog(LOG_WARNING, "[obs-browser]: Failed to register obs-websocket request get_frame_snapshot_stats");
+
+	auto get_frame_rate_policy_request_cb = [](obs_data_t *, obs_data_t *response_data, void *) {
+		GetFrameRatePolicy(response_data);
+	};
+
+	if (!obs_websocket_vendor_register_request(vendor, "get_frame_rate_policy", get_frame_rate_policy_request_cb,
+						   nullptr))
+		blog(LOG_WARNING, "[obs-browser]: Failed to register obs-websocket request get_frame_rate_policy");
+
+	auto set_frame_rate_policy_request_cb = [](obs_data_t *request_data, obs_data_t *response_data, void *) {
+		SetFrameRatePolicy(request_data);
+		SaveFrameRatePolicy();
+		GetFrameRatePolicy(response_data);
+	};
+
+	if (!obs_websocket_vendor_register_request(vendor, "set_frame_rate_policy", set_frame_rate_policy_request_cb,
+						   nullptr))
+		blog(LOG_WARNING, "[obs-browser]: Failed to register obs-websocket request set_frame_rate_policy");
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+	auto get_cpu_governor_request_cb = [](obs_data_t *, obs_data_t *response_data, void *) {
+		GetCpuGovernor(response_data);
+	};
+
+	if (!obs_websocket_vendor_register_request(vendor, "get_cpu_governor", get_cpu_governor_request_cb, nullptr))
+		blog(LOG_WARNING, "[obs-browser]: Failed to register obs-websocket request get_cpu_governor");
+
+	auto set_cpu_governor_request_cb = [](obs_data_t *request_data, obs_data_t *response_data, void *) {
+		SetCpuGovernor(request_data);
+		SaveCpuGovernor();
+		GetCpuGovernor(response_data);
+	};
+
+	if (!obs_websocket_vendor_register_request(vendor, "set_cpu_governor", set_cpu_governor_request_cb, nullptr))
+		blog(LOG_WARNING, "[obs-browser]: Failed to register obs-websocket request set_cpu_governor");
+#endif
 }
 
 void obs_module_unload(void)
 {
+	obs_remove_tick_callback(browser_tick, nullptr);
+	StopBeginFrameScheduler();
+	StopSnapshotWorkers();
+#if !defined(_WIN32) && !defined(__APPLE__)
+	StopCpuGovernor();
+#endif
+
 #ifdef ENABLE_BROWSER_QT_LOOP
 	BrowserShutdown();
 #else
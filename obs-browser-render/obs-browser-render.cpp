@@ -0,0 +1,368 @@
+/******************************************************************************
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/* Renders a page offline, on virtual time.  Every frame advances the page's
+ * clock (timers, requestAnimationFrame, CSS animations) by exactly 1/fps and
+ * is painted by an external begin frame, so the output does not depend on
+ * how fast the machine is, and is produced as fast as it can paint:
+ *
+ *   obs-browser-render --url URL --frames N [--width 1920] [--height 1080]
+ *                      [--fps 60] [--output DIR|-] [-- chromium switches]
+ *
+ * With a directory, frames are written as frame-000000.pam and so on;
+ * with "-", as raw BGRA on stdout, e.g. for
+ *
+ *   ffmpeg -f rawvideo -pixel_format bgra -video_size 1920x1080
+ *          -framerate 60 -i - out.mov
+ *
+ * Uses software compositing with the headless ozone platform, so it needs
+ * neither a GPU nor a display. */
+
+#include "browser-app.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#define DEVTOOLS_PAUSE_ID 1
+#define DEVTOOLS_STEP_ID 2
+
+struct RenderOptions {
+	std::string url;
+	std::string output = ".";
+	int width = 1920;
+	int height = 1080;
+	double fps = 60.0;
+	int frames = 0;
+};
+
+class OfflineClient : public CefClient,
+		      public CefRenderHandler,
+		      public CefLifeSpanHandler,
+		      public CefLoadHandler,
+		      public CefDevToolsMessageObserver {
+	RenderOptions options;
+	CefRefPtr<CefBrowser> browser;
+	CefRefPtr<CefRegistration> observer;
+
+	int frame = 0;
+	bool stepping = false;
+	bool waiting_paint = false;
+	std::vector<uint8_t> rgba;
+
+	void Step();
+	bool WriteFrame(const uint8_t *data, int cx, int cy);
+	void Finish(bool success);
+
+public:
+	int exit_code = 0;
+
+	inline OfflineClient(const RenderOptions &options_) : options(options_) {}
+
+	virtual CefRefPtr<CefRenderHandler> GetRenderHandler() override { return this; }
+	virtual CefRefPtr<CefLifeSpanHandler> GetLifeSpanHandler() override { return this; }
+	virtual CefRefPtr<CefLoadHandler> GetLoadHandler() override { return this; }
+
+	/* CefRenderHandler */
+	virtual void GetViewRect(CefRefPtr<CefBrowser>, CefRect &rect) override;
+	virtual void OnPaint(CefRefPtr<CefBrowser>, PaintElementType type, const RectList &, const void *buffer,
+			     int width, int height) override;
+
+	/* CefLifeSpanHandler */
+	virtual void OnAfterCreated(CefRefPtr<CefBrowser> browser) override;
+	virtual void OnBeforeClose(CefRefPtr<CefBrowser> browser) override;
+
+	/* CefLoadHandler */
+	virtual void OnLoadEnd(CefRefPtr<CefBrowser>, CefRefPtr<CefFrame> frame, int) override;
+	virtual void OnLoadError(CefRefPtr<CefBrowser>, CefRefPtr<CefFrame> frame, ErrorCode code,
+				 const CefString &error, const CefString &url) override;
+
+	/* CefDevToolsMessageObserver */
+	virtual void OnDevToolsMethodResult(CefRefPtr<CefBrowser>, int message_id, bool success, const void *,
+					    size_t) override;
+	virtual void OnDevToolsEvent(CefRefPtr<CefBrowser>, const CefString &method, const void *, size_t) override;
+
+	IMPLEMENT_REFCOUNTING(OfflineClient);
+};
+
+void OfflineClient::GetViewRect(CefRefPtr<CefBrowser>, CefRect &rect)
+{
+	rect.Set(0, 0, options.width, options.height);
+}
+
+void OfflineClient::OnAfterCreated(CefRefPtr<CefBrowser> browser_)
+{
+	browser = browser_;
+	observer = browser->GetHost()->AddDevToolsMessageObserver(this);
+
+	/* the page's clock only moves when a step advances it, from the very
+	 * start of the load */
+	CefRefPtr<CefDictionaryValue> params = CefDictionaryValue::Create();
+	params->SetString("policy", "pause");
+	browser->GetHost()->ExecuteDevToolsMethod(DEVTOOLS_PAUSE_ID, "Emulation.setVirtualTimePolicy", params);
+}
+
+void OfflineClient::OnBeforeClose(CefRefPtr<CefBrowser>)
+{
+	observer = nullptr;
+	browser = nullptr;
+	CefQuitMessageLoop();
+}
+
+void OfflineClient::OnDevToolsMethodResult(CefRefPtr<CefBrowser>, int message_id, bool success, const void *,
+					   size_t)
+{
+	if (!success) {
+		fprintf(stderr, "Failed to set the virtual time policy\n");
+		Finish(false);
+		return;
+	}
+
+	if (message_id == DEVTOOLS_PAUSE_ID)
+		browser->GetMainFrame()->LoadURL(options.url);
+}
+
+void OfflineClient::OnLoadEnd(CefRefPtr<CefBrowser>, CefRefPtr<CefFrame> frame, int)
+{
+	/* the initial about:blank finishes loading as well */
+	if (stepping || !frame->IsMain() || frame->GetURL() == "about:blank")
+		return;
+
+	stepping = true;
+	Step();
+}
+
+void OfflineClient::OnLoadError(CefRefPtr<CefBrowser>, CefRefPtr<CefFrame> frame, ErrorCode code,
+				const CefString &error, const CefString &url)
+{
+	if (stepping || !frame->IsMain() || code == ERR_ABORTED)
+		return;
+
+	fprintf(stderr, "Failed to load '%s': %s\n", url.ToString().c_str(), error.ToString().c_str());
+	Finish(false);
+}
+
+void OfflineClient::Step()
+{
+	if (frame == options.frames) {
+		Finish(true);
+		return;
+	}
+
+	/* budgets are computed from the absolute frame times, so rounding
+	 * does not accumulate over long renders */
+	const double start = frame * 1000.0 / options.fps;
+	const double end = (frame + 1) * 1000.0 / options.fps;
+
+	CefRefPtr<CefDictionaryValue> params = CefDictionaryValue::Create();
+	params->SetString("policy", "pauseIfNetworkFetchesPending");
+	params->SetDouble("budget", end - start);
+	browser->GetHost()->ExecuteDevToolsMethod(DEVTOOLS_STEP_ID, "Emulation.setVirtualTimePolicy", params);
+}
+
+void OfflineClient::OnDevToolsEvent(CefRefPtr<CefBrowser>, const CefString &method, const void *, size_t)
+{
+	if (method != "Emulation.virtualTimeBudgetExpired")
+		return;
+
+	/* the page is at the time of the next frame, paint it.  The view is
+	 * invalidated so that a frame is painted even if nothing changed. */
+	waiting_paint = true;
+	browser->GetHost()->Invalidate(PET_VIEW);
+	browser->GetHost()->SendExternalBeginFrame();
+}
+
+void OfflineClient::OnPaint(CefRefPtr<CefBrowser>, PaintElementType type, const RectList &, const void *buffer,
+			    int width, int height)
+{
+	if (type != PET_VIEW || !waiting_paint)
+		return;
+
+	waiting_paint = false;
+
+	if (!WriteFrame((const uint8_t *)buffer, width, height)) {
+		Finish(false);
+		return;
+	}
+
+	frame++;
+	Step();
+}
+
+bool OfflineClient::WriteFrame(const uint8_t *data, int cx, int cy)
+{
+	const size_t size = (size_t)cx * cy * 4;
+
+	if (options.output == "-")
+		return fwrite(data, 1, size, stdout) == size;
+
+	char name[32];
+	snprintf(name, sizeof(name), "/frame-%06d.pam", frame);
+	const std::string path = options.output + name;
+
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f) {
+		fprintf(stderr, "Failed to open '%s': %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+
+	rgba.resize(size);
+	for (size_t i = 0; i < size; i += 4) {
+		rgba[i + 0] = data[i + 2];
+		rgba[i + 1] = data[i + 1];
+		rgba[i + 2] = data[i + 0];
+		rgba[i + 3] = data[i + 3];
+	}
+
+	fprintf(f, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", cx, cy);
+	const bool success = fwrite(rgba.data(), 1, size, f) == size;
+	fclose(f);
+
+	if (!success)
+		fprintf(stderr, "Failed to write '%s'\n", path.c_str());
+	return success;
+}
+
+void OfflineClient::Finish(bool success)
+{
+	if (!success)
+		exit_code = 1;
+	else
+		fprintf(stderr, "Rendered %d frames\n", frame);
+
+	if (browser)
+		browser->GetHost()->CloseBrowser(true);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void Usage()
+{
+	fprintf(stderr, "usage: obs-browser-render --url URL --frames N [--width W] [--height H] [--fps FPS]\n"
+			"                          [--output DIR|-] [-- chromium switches]\n");
+}
+
+static bool ParseOptions(int argc, char *argv[], RenderOptions &options, std::vector<char *> &cef_argv)
+{
+	int i = 1;
+	for (; i < argc; i++) {
+		const char *arg = argv[i];
+		if (strcmp(arg, "--") == 0) {
+			i++;
+			break;
+		}
+		if (i + 1 == argc)
+			return false;
+
+		const char *value = argv[++i];
+		if (strcmp(arg, "--url") == 0)
+			options.url = value;
+		else if (strcmp(arg, "--output") == 0)
+			options.output = value;
+		else if (strcmp(arg, "--width") == 0)
+			options.width = atoi(value);
+		else if (strcmp(arg, "--height") == 0)
+			options.height = atoi(value);
+		else if (strcmp(arg, "--fps") == 0)
+			options.fps = atof(value);
+		else if (strcmp(arg, "--frames") == 0)
+			options.frames = atoi(value);
+		else
+			return false;
+	}
+
+	for (; i < argc; i++)
+		cef_argv.push_back(argv[i]);
+
+	return !options.url.empty() && options.width > 0 && options.height > 0 && options.fps > 0.0 &&
+	       options.frames > 0;
+}
+
+static std::string ExecutableDir()
+{
+	char path[4096];
+	const ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+	if (len <= 0)
+		return ".";
+
+	path[len] = 0;
+	char *slash = strrchr(path, '/');
+	if (slash)
+		*slash = 0;
+	return path;
+}
+
+int main(int argc, char *argv[])
+{
+	RenderOptions options;
+
+	/* only switches after "--" and the ones needed to run without a GPU or
+	 * a display are passed on to chromium */
+	static char headless[] = "--ozone-platform=headless";
+	static char disable_gpu[] = "--disable-gpu";
+	std::vector<char *> cef_argv = {argv[0], headless, disable_gpu};
+
+	if (!ParseOptions(argc, argv, options, cef_argv)) {
+		Usage();
+		return 1;
+	}
+
+	CefMainArgs args((int)cef_argv.size(), cef_argv.data());
+	CefRefPtr<BrowserApp> app(new BrowserApp());
+
+	const std::string dir = ExecutableDir();
+
+	CefSettings settings;
+	settings.log_severity = LOGSEVERITY_ERROR;
+	settings.windowless_rendering_enabled = true;
+	settings.no_sandbox = true;
+	CefString(&settings.browser_subprocess_path) = dir + "/obs-browser-page";
+	CefString(&settings.locales_dir_path) = dir + "/locales";
+
+	if (!CefInitialize(args, settings, app, nullptr)) {
+		fprintf(stderr, "Failed to initialize CEF\n");
+		return 1;
+	}
+
+	CefRefPtr<OfflineClient> client(new OfflineClient(options));
+
+	CefWindowInfo windowInfo;
+	windowInfo.bounds.width = options.width;
+	windowInfo.bounds.height = options.height;
+	windowInfo.windowless_rendering_enabled = true;
+	windowInfo.external_begin_frame_enabled = true;
+
+	CefBrowserSettings browserSettings;
+	browserSettings.windowless_frame_rate = 0;
+	browserSettings.default_font_size = 16;
+	browserSettings.default_fixed_font_size = 16;
+
+	CefBrowserHost::CreateBrowser(windowInfo, client.get(), "about:blank", browserSettings,
+				      CefRefPtr<CefDictionaryValue>(), nullptr);
+
+	CefRunMessageLoop();
+
+	const int exit_code = client->exit_code;
+	client = nullptr;
+	CefShutdown();
+
+	if (options.output == "-")
+		fflush(stdout);
+	return exit_code;
+}
@@ -0,0 +1,200 @@
+/******************************************************************************
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/* Reference reader for the frames browser sources publish to shared memory.
+ * Prints every frame it manages to read, and writes the last one to a PAM
+ * file if asked to:
+ *
+ *   obs-browser-shm-reader /obs-browser-<name> [count] [last-frame.pam] */
+
+#include "browser-shm-protocol.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct Mapping {
+	void *ptr = MAP_FAILED;
+	size_t size = 0;
+
+	inline BrowserShmHeader *Header() const { return (BrowserShmHeader *)ptr; }
+
+	bool Open(const char *name)
+	{
+		const int fd = shm_open(name, O_RDONLY, 0);
+		if (fd == -1)
+			return false;
+
+		struct stat st;
+		if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(BrowserShmHeader)) {
+			size = (size_t)st.st_size;
+			ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+		}
+		close(fd);
+
+		if (ptr == MAP_FAILED)
+			return false;
+
+		const BrowserShmHeader *header = Header();
+		if (header->magic != BROWSER_SHM_MAGIC || header->version != BROWSER_SHM_VERSION) {
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void Close()
+	{
+		if (ptr != MAP_FAILED)
+			munmap(ptr, size);
+		ptr = MAP_FAILED;
+		size = 0;
+	}
+};
+
+struct Frame {
+	BrowserShmSlot info;
+	std::vector<uint8_t> data;
+};
+
+enum class ReadResult {
+	None,
+	Frame,
+	Torn,
+};
+
+static ReadResult ReadLatest(const Mapping &mapping, uint64_t last_seq, Frame &frame)
+{
+	const BrowserShmHeader *header = mapping.Header();
+	const uint64_t seq = header->latest_seq.load(std::memory_order_acquire);
+	if (!seq || seq == last_seq)
+		return ReadResult::None;
+
+	const size_t idx = seq % header->slot_count;
+	const BrowserShmSlot &slot = header->slots[idx];
+
+	const uint64_t lock = slot.lock.load(std::memory_order_acquire);
+	if (lock & 1)
+		return ReadResult::Torn;
+
+	frame.info.seq = slot.seq;
+	frame.info.timestamp = slot.timestamp;
+	frame.info.cx = slot.cx;
+	frame.info.cy = slot.cy;
+	frame.info.linesize = slot.linesize;
+	frame.info.format = slot.format;
+
+	const size_t size = (size_t)frame.info.linesize * frame.info.cy;
+	if (size > header->slot_size)
+		return ReadResult::Torn;
+
+	frame.data.resize(size);
+	memcpy(frame.data.data(), (const uint8_t *)mapping.ptr + header->data_offset + idx * header->slot_size, size);
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (slot.lock.load(std::memory_order_relaxed) != lock || frame.info.seq != seq)
+		return ReadResult::Torn;
+
+	return ReadResult::Frame;
+}
+
+static bool WritePAM(const char *path, const Frame &frame)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file)
+		return false;
+
+	fprintf(file, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", frame.info.cx,
+		frame.info.cy);
+
+	std::vector<uint8_t> row((size_t)frame.info.cx * 4);
+	for (uint32_t y = 0; y < frame.info.cy; y++) {
+		const uint8_t *src = frame.data.data() + (size_t)y * frame.info.linesize;
+		for (uint32_t x = 0; x < frame.info.cx; x++) {
+			row[x * 4 + 0] = src[x * 4 + 2];
+			row[x * 4 + 1] = src[x * 4 + 1];
+			row[x * 4 + 2] = src[x * 4 + 0];
+			row[x * 4 + 3] = frame.info.format == BROWSER_SHM_FORMAT_BGRX ? 255 : src[x * 4 + 3];
+		}
+		fwrite(row.data(), 1, row.size(), file);
+	}
+
+	return fclose(file) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s /obs-browser-<name> [count] [last-frame.pam]\n", argv[0]);
+		return 1;
+	}
+
+	const char *name = argv[1];
+	const long count = argc > 2 ? strtol(argv[2], nullptr, 10) : 0;
+	const char *pam_path = argc > 3 ? argv[3] : nullptr;
+
+	Mapping mapping;
+	Frame frame;
+	uint64_t last_seq = 0;
+	uint64_t skipped = 0;
+	uint64_t torn = 0;
+	long frames = 0;
+
+	while (!count || frames < count) {
+		if (mapping.ptr == MAP_FAILED || mapping.Header()->closed.load(std::memory_order_acquire)) {
+			/* not created yet, or replaced by a bigger one */
+			mapping.Close();
+			if (!mapping.Open(name)) {
+				usleep(100000);
+				continue;
+			}
+			last_seq = 0;
+		}
+
+		switch (ReadLatest(mapping, last_seq, frame)) {
+		case ReadResult::None:
+			usleep(1000);
+			continue;
+		case ReadResult::Torn:
+			torn++;
+			continue;
+		case ReadResult::Frame:
+			break;
+		}
+
+		if (last_seq && frame.info.seq > last_seq + 1)
+			skipped += frame.info.seq - last_seq - 1;
+		last_seq = frame.info.seq;
+		frames++;
+
+		printf("frame %llu: %ux%u stride %u %s, ts %llu, skipped %llu, torn %llu\n",
+		       (unsigned long long)frame.info.seq, frame.info.cx, frame.info.cy, frame.info.linesize,
+		       frame.info.format == BROWSER_SHM_FORMAT_BGRX ? "BGRX" : "BGRA",
+		       (unsigned long long)frame.info.timestamp, (unsigned long long)skipped, (unsigned long long)torn);
+	}
+
+	if (pam_path && frames && !WritePAM(pam_path, frame)) {
+		fprintf(stderr, "failed to write %s\n", pam_path);
+		return 1;
+	}
+
+	mapping.Close();
+	return 0;
+}
@@ -22,8 +22,13 @@
 #include "wide-string.hpp"
 #include <nlohmann/json.hpp>
 #include <util/threading.h>
+#include <util/platform.h>
 #include <QApplication>
 #include <util/dstr.h>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
 #include <functional>
 #include <thread>
 #include <mutex>
@@ -131,6 +136,7 @@ BrowserSource::~BrowserSource()
 {
 	if (cefBrowser)
 		ActuallyCloseBrowser(cefBrowser);
+	obs_source_release(video_source);
 }
 
 void BrowserSource::Destroy()
@@ -143,6 +149,12 @@ void BrowserSource::Destroy()
 		next->p_prev_next = p_prev_next;
 	*p_prev_next = next;
 
+	if (!first_browser) {
+		obs_enter_graphics();
+		FreeTexturePool();
+		obs_leave_graphics();
+	}
+
 	QueueCEFTask([this]() { delete this; });
 }
 
@@ -196,8 +208,21 @@ bool BrowserSource::CreateBrowser()
 		bool hwaccel = false;
 #endif
 
-		CefRefPtr<BrowserClient> browserClient =
-			new BrowserClient(this, hwaccel && tex_sharing_avail, reroute_audio, webpage_control_level);
+		CefRefPtr<BrowserClient> browserClient = new BrowserClient(
+			this, hwaccel && tex_sharing_avail, reroute_audio, webpage_control_level, opaque);
+		cpu_begin_frames = begin_frame_sync && !(hwaccel && tex_sharing_avail);
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+		if (shm_export) {
+			std::string shm_name = "/obs-browser-";
+			for (const char *c = obs_source_get_name(source); *c; c++)
+				shm_name += isalnum((unsigned char)*c) ? *c : '_';
+
+			browserClient->frame_export = std::make_unique<ShmFrameExport>(shm_name);
+			blog(LOG_INFO, "[obs-browser]: Browser source '%s' exports its frames to shared memory '%s'",
+			     obs_source_get_name(source), shm_name.c_str());
+		}
+#endif
 
 		CefWindowInfo windowInfo;
 #if CHROME_VERSION_BUILD < 4430
@@ -233,9 +258,38 @@ bool BrowserSource::CreateBrowser()
 		cefBrowserSettings.windowless_frame_rate = fps;
 #endif
 
+		if (cpu_begin_frames) {
+			windowInfo.external_begin_frame_enabled = true;
+			cefBrowserSettings.windowless_frame_rate = 0;
+		}
+
+		/* begin frame driven browsers follow the OBS frame rate */
+		struct obs_video_info video_info;
+		const double video_fps = obs_get_video_info(&video_info)
+						 ? (double)video_info.fps_num / (double)video_info.fps_den
+						 : 30.0;
+		external_begin_frames = windowInfo.external_begin_frame_enabled;
+		max_frame_rate = cefBrowserSettings.windowless_frame_rate ? cefBrowserSettings.windowless_frame_rate
+									   : video_fps;
+		frame_rate = max_frame_rate.load();
+		boost_frame_rate = video_fps;
+		begin_frame_credit = 0.0;
+		page_frame_rate = 0.0;
+		page_paused = false;
+		page_frame_pending = false;
+#if !defined(_WIN32) && !defined(__APPLE__)
+		renderer_pid = 0;
+#endif
+		idle = false;
+		last_activity_ts = os_gettime_ns();
+
 		cefBrowserSettings.default_font_size = 16;
 		cefBrowserSettings.default_fixed_font_size = 16;
 
+		/* lets Chromium skip compositing against transparency */
+		if (opaque)
+			cefBrowserSettings.background_color = CefColorSetARGB(255, 255, 255, 255);
+
 #if ENABLE_LOCAL_FILE_URL_SCHEME && CHROME_VERSION_BUILD < 4430
 		if (is_local) {
 			/* Disable web security for file:// URLs to allow
@@ -252,6 +306,7 @@ bool BrowserSource::CreateBrowser()
 			cefBrowser->GetHost()->SetAudioMuted(true);
 		if (obs_source_showing(source))
 			is_showing = true;
+		is_active = obs_source_active(source);
 
 		SendBrowserVisibility(cefBrowser, is_showing);
 	});
@@ -289,6 +344,7 @@ void BrowserSource::SendMouseClick(const struct obs_mouse_event *event, int32_t
 			cefBrowser->GetHost()->SendMouseClickEvent(e, buttonType, mouse_up, click_count);
 		},
 		true);
+	MarkInput();
 }
 
 void BrowserSource::SendMouseMove(const struct obs_mouse_event *event, bool mouse_leave)
@@ -306,6 +362,7 @@ void BrowserSource::SendMouseMove(const struct obs_mouse_event *event, bool mous
 			cefBrowser->GetHost()->SendMouseMoveEvent(e, mouse_leave);
 		},
 		true);
+	MarkInput();
 }
 
 void BrowserSource::SendMouseWheel(const struct obs_mouse_event *event, int x_delta, int y_delta)
@@ -323,6 +380,7 @@ void BrowserSource::SendMouseWheel(const struct obs_mouse_event *event, int x_de
 			cefBrowser->GetHost()->SendMouseWheelEvent(e, x_delta, y_delta);
 		},
 		true);
+	MarkInput();
 }
 
 void BrowserSource::SendFocus(bool focus)
@@ -389,6 +447,7 @@ void BrowserSource::SendKeyClick(const struct obs_key_event *event, bool key_up)
 			}
 		},
 		true);
+	MarkInput();
 }
 
 void BrowserSource::SetShowing(bool showing)
@@ -397,6 +456,11 @@ void BrowserSource::SetShowing(bool showing)
 		return;
 
 	is_showing = showing;
+	ApplyFrameRate();
+
+	/* no browser to show or hide, the frozen frame stays */
+	if (snapshot_frozen)
+		return;
 
 	if (shutdown_on_invisible) {
 		if (showing) {
@@ -439,6 +503,9 @@ void BrowserSource::SetShowing(bool showing)
 
 void BrowserSource::SetActive(bool active)
 {
+	is_active = active;
+	ApplyFrameRate();
+
 	ExecuteOnBrowser(
 		[=](CefRefPtr<CefBrowser> cefBrowser) {
 			CefRefPtr<CefProcessMessage> msg = CefProcessMessage::Create("Active");
@@ -454,9 +521,387 @@ void BrowserSource::SetActive(bool active)
 
 void BrowserSource::Refresh()
 {
+	/* the browser of a frozen snapshot was closed, start a new one;
+	 * a loop is recorded again from the start */
+	if (snapshot_frozen || loop_capture) {
+		Update();
+		return;
+	}
+
 	ExecuteOnBrowser([](CefRefPtr<CefBrowser> cefBrowser) { cefBrowser->ReloadIgnoreCache(); }, true);
 }
 
+void BrowserSource::GetStats(obs_data_t *data)
+{
+	obs_data_set_int(data, "frames_uploaded", (long long)stats.frames_uploaded);
+	obs_data_set_int(data, "partial_uploads", (long long)stats.partial_uploads);
+	obs_data_set_int(data, "bytes_uploaded", (long long)stats.bytes_uploaded);
+	obs_data_set_int(data, "last_frame_bytes", (long long)stats.last_frame_bytes);
+	obs_data_set_int(data, "frames_dropped", (long long)stats.frames_dropped);
+	obs_data_set_int(data, "duplicate_frames", (long long)stats.duplicate_frames);
+	obs_data_set_int(data, "hash_ns", (long long)stats.hash_ns);
+	obs_data_set_int(data, "upload_ns", (long long)stats.upload_ns);
+	obs_data_set_int(data, "last_drawn_pixels", (long long)stats.last_drawn_pixels);
+	obs_data_set_int(data, "texture_copies", (long long)stats.texture_copies);
+	obs_data_set_int(data, "copies_skipped", (long long)stats.copies_skipped);
+	obs_data_set_int(data, "renders", (long long)stats.renders);
+	obs_data_set_int(data, "render_ns", (long long)stats.render_ns);
+	obs_data_set_bool(data, "snapshot_frozen", snapshot_frozen);
+	obs_data_set_int(data, "loop_frames", (long long)stats.loop_frames);
+	obs_data_set_int(data, "loop_bytes", (long long)stats.loop_bytes);
+	obs_data_set_int(data, "async_frames", (long long)stats.async_frames);
+	obs_data_set_int(data, "convert_ns", (long long)stats.convert_ns);
+	obs_data_set_int(data, "begin_frames", (long long)stats.begin_frames);
+	obs_data_set_int(data, "begin_frames_skipped", (long long)stats.begin_frames_skipped);
+	obs_data_set_double(data, "begin_frame_rate", begin_frame_timing->rate);
+	obs_data_set_int(data, "begin_frame_lead_ns", (long long)begin_frame_timing->lead_ns);
+	obs_data_set_int(data, "begin_frame_paint_ns", (long long)begin_frame_timing->paint_ns);
+	obs_data_set_int(data, "begin_frame_latency_ns", (long long)begin_frame_timing->latency_ns);
+	obs_data_set_int(data, "begin_frames_on_time", (long long)begin_frame_timing->on_time);
+	obs_data_set_int(data, "begin_frames_late", (long long)begin_frame_timing->late);
+	obs_data_set_int(data, "begin_frames_decimated", (long long)stats.begin_frames_decimated);
+	obs_data_set_double(data, "frame_rate", frame_rate);
+	obs_data_set_string(data, "frame_rate_tier", is_active ? "program" : is_showing ? "preview" : "hidden");
+	obs_data_set_bool(data, "idle", idle);
+	obs_data_set_int(data, "idle_transitions", (long long)stats.idle_transitions);
+	obs_data_set_int(data, "active_transitions", (long long)stats.active_transitions);
+	obs_data_set_bool(data, "boosted", Boosted());
+	obs_data_set_int(data, "boosts", (long long)stats.boosts);
+	obs_data_set_int(data, "input_latency_ns", (long long)stats.input_latency_ns);
+	obs_data_set_int(data, "input_latency_samples", (long long)stats.input_latency_samples);
+	obs_data_set_double(data, "page_frame_rate", page_frame_rate);
+	obs_data_set_bool(data, "page_paused", page_paused);
+	obs_data_set_int(data, "page_frame_requests", (long long)stats.page_frame_requests);
+#if !defined(_WIN32) && !defined(__APPLE__)
+	obs_data_set_int(data, "dmabuf_imports", (long long)dmabuf_cache.imports);
+	obs_data_set_int(data, "dmabuf_cache_hits", (long long)dmabuf_cache.hits);
+	obs_data_set_int(data, "dmabuf_evictions", (long long)dmabuf_cache.evictions);
+	obs_data_set_int(data, "renderer_pid", renderer_pid);
+	obs_data_set_double(data, "governor_frame_rate", governor_frame_rate);
+#endif
+}
+
+void BrowserSource::MarkActivity()
+{
+	last_activity_ts.store(os_gettime_ns(), std::memory_order_relaxed);
+
+	if (idle.exchange(false)) {
+		stats.active_transitions++;
+		ApplyFrameRate();
+	}
+}
+
+/* how long a boost lasts after the last input */
+#define BOOST_DURATION_NS 3000000000ULL
+
+void BrowserSource::MarkInput()
+{
+	const uint64_t now = os_gettime_ns();
+
+	uint64_t no_input = 0;
+	input_ts.compare_exchange_strong(no_input, now);
+
+	if (!interaction_boost) {
+		MarkActivity();
+		return;
+	}
+
+	if (boost_until_ts.exchange(now + BOOST_DURATION_NS) < now)
+		stats.boosts++;
+
+	MarkActivity();
+	ApplyFrameRate();
+
+	/* paint the reaction to the input right away rather than on the next
+	 * OBS frame, at most once per frame interval */
+	const uint64_t interval = (uint64_t)(1000000000.0 / boost_frame_rate);
+	if (external_begin_frames && !page_paused && now - boost_begin_frame_ts > interval) {
+		boost_begin_frame_ts = now;
+		ExecuteOnBrowser(
+			[](CefRefPtr<CefBrowser> cefBrowser) { cefBrowser->GetHost()->SendExternalBeginFrame(); },
+			true);
+	}
+}
+
+void BrowserSource::MarkPaint()
+{
+	/* input that changed nothing on the page is not counted when
+	 * something else paints much later */
+	const uint64_t input = input_ts.exchange(0);
+	const uint64_t latency = os_gettime_ns() - input;
+	if (input && latency < BOOST_DURATION_NS) {
+		const uint64_t prev = stats.input_latency_ns;
+		stats.input_latency_ns = prev ? prev - prev / 8 + latency / 8 : latency;
+		stats.input_latency_samples++;
+	}
+
+	MarkActivity();
+}
+
+bool BrowserSource::Boosted()
+{
+	return interaction_boost && os_gettime_ns() < boost_until_ts;
+}
+
+static std::atomic<bool> tiers_enabled = false;
+static std::atomic<int> tiers_preview_fps = 15;
+static std::atomic<int> tiers_hidden_fps = 1;
+
+double BrowserSource::TierFrameRate()
+{
+	int preview = tiers_preview_fps;
+	int hidden = tiers_hidden_fps;
+
+	switch (frame_rate_policy) {
+	case FrameRatePolicy::Full:
+		return 0.0;
+	case FrameRatePolicy::Custom:
+		preview = preview_fps;
+		hidden = hidden_fps;
+		break;
+	default:
+		if (!tiers_enabled)
+			return 0.0;
+	}
+
+	if (is_active)
+		return 0.0;
+	return is_showing ? preview : hidden;
+}
+
+double BrowserSource::EffectiveFrameRate()
+{
+	double rate = max_frame_rate;
+	const double tier = TierFrameRate();
+	if (tier > 0.0)
+		rate = std::min(rate, tier);
+	if (idle)
+		rate = std::min(rate, (double)idle_fps);
+#if !defined(_WIN32) && !defined(__APPLE__)
+	const double governor = governor_frame_rate;
+	if (governor > 0.0 && !is_active)
+		rate = std::min(rate, governor);
+#endif
+	const double page = page_frame_rate;
+	if (page > 0.0)
+		rate = std::min(rate, page);
+	if (Boosted())
+		rate = std::max(rate, (double)boost_frame_rate);
+	/* the lowest windowless rate, external begin frames stop entirely */
+	if (page_paused && !page_frame_pending)
+		rate = std::min(rate, 1.0);
+	return rate;
+}
+
+void BrowserSource::ApplyFrameRate()
+{
+	const double rate = EffectiveFrameRate();
+	if (rate <= 0.0 || frame_rate.exchange(rate) == rate)
+		return;
+
+	/* decimated by TakeBeginFrame */
+	if (external_begin_frames)
+		return;
+
+	const int windowless_rate = std::max(1, (int)std::lround(rate));
+	ExecuteOnBrowser(
+		[windowless_rate](CefRefPtr<CefBrowser> cefBrowser) {
+			cefBrowser->GetHost()->SetWindowlessFrameRate(windowless_rate);
+		},
+		true);
+}
+
+void BrowserSource::UpdateFrameRate()
+{
+	const uint64_t timeout_ns = (uint64_t)idle_timeout * 1000000ULL;
+	if (timeout_ns && !idle && cefBrowser &&
+	    os_gettime_ns() - last_activity_ts.load(std::memory_order_relaxed) > timeout_ns) {
+		idle = true;
+		stats.idle_transitions++;
+	}
+
+	ApplyFrameRate();
+}
+
+bool BrowserSource::TakeBeginFrame(double video_fps)
+{
+	if (page_paused) {
+		if (page_frame_pending)
+			return true;
+
+		stats.begin_frames_decimated++;
+		return false;
+	}
+
+	const double rate = frame_rate;
+	if (rate <= 0.0 || rate >= video_fps) {
+		begin_frame_credit = 0.0;
+		return true;
+	}
+
+	begin_frame_credit += rate / video_fps;
+	if (begin_frame_credit < 1.0) {
+		stats.begin_frames_decimated++;
+		return false;
+	}
+
+	begin_frame_credit -= 1.0;
+	return true;
+}
+
+void BrowserSource::SetPageFrameRate(double rate)
+{
+	page_frame_rate = rate > 0.0 ? std::clamp(rate, 1.0, (double)max_frame_rate) : 0.0;
+
+	/* a page raising its rate is about to animate */
+	MarkActivity();
+	ApplyFrameRate();
+}
+
+void BrowserSource::SetPagePaused(bool paused)
+{
+	if (page_paused.exchange(paused) == paused)
+		return;
+
+	if (!paused)
+		MarkActivity();
+	ApplyFrameRate();
+}
+
+void BrowserSource::RequestPageFrame()
+{
+	stats.page_frame_requests++;
+
+	/* painted on the next begin frame, or at the full windowless rate
+	 * until the frame comes; requests before it are coalesced into it */
+	if (page_frame_pending.exchange(true))
+		return;
+
+	ApplyFrameRate();
+	ExecuteOnBrowser([](CefRefPtr<CefBrowser> cefBrowser) { cefBrowser->GetHost()->Invalidate(PET_VIEW); },
+			 true);
+}
+
+void BrowserSource::ResetPageControl()
+{
+	page_frame_rate = 0.0;
+	page_paused = false;
+	page_frame_pending = false;
+	ApplyFrameRate();
+}
+
+void BrowserSource::FinishPageFrame()
+{
+	if (page_frame_pending.exchange(false))
+		ApplyFrameRate();
+}
+
+std::future<std::shared_ptr<FrameSnapshot>> BrowserSource::RequestFrameSnapshot(uint64_t &id)
+{
+	if (tex_sharing_avail && hwaccel)
+		return {};
+
+	/* frozen, replaying its loop or shut down, no paint will come */
+	if (!GetBrowser()) {
+		std::promise<std::shared_ptr<FrameSnapshot>> shown;
+		obs_enter_graphics();
+		shown.set_value(GetShownFrameSnapshot());
+		obs_leave_graphics();
+		return shown.get_future();
+	}
+
+	std::future<std::shared_ptr<FrameSnapshot>> future;
+	{
+		std::lock_guard<std::mutex> lock(frame_snapshot_mutex);
+		id = ++frame_snapshot_next_id;
+		frame_snapshot_requests.push_back({id, {}});
+		future = frame_snapshot_requests.back().promise.get_future();
+		frame_snapshot_pending = true;
+	}
+
+	ExecuteOnBrowser([](CefRefPtr<CefBrowser> cefBrowser) { cefBrowser->GetHost()->Invalidate(PET_VIEW); },
+			 true);
+	return future;
+}
+
+void BrowserSource::CancelFrameSnapshot(uint64_t id)
+{
+	std::lock_guard<std::mutex> lock(frame_snapshot_mutex);
+
+	for (auto it = frame_snapshot_requests.begin(); it != frame_snapshot_requests.end(); ++it) {
+		if (it->id == id) {
+			frame_snapshot_requests.erase(it);
+			break;
+		}
+	}
+	if (frame_snapshot_requests.empty())
+		frame_snapshot_pending = false;
+}
+
+std::shared_ptr<FrameSnapshot> BrowserSource::GetShownFrameSnapshot()
+{
+	auto snapshot = std::make_shared<FrameSnapshot>();
+	snapshot->timestamp = os_gettime_ns();
+
+	if (snapshot_frozen && loop.Complete()) {
+		snapshot->cx = loop.Width();
+		snapshot->cy = loop.Height();
+		snapshot->data.assign(loop.Data(), loop.Data() + (size_t)snapshot->cx * snapshot->cy * 4);
+		return snapshot;
+	}
+
+	if (snapshot_frozen) {
+		if (!snapshot_cx || !snapshot_cy)
+			return nullptr;
+
+		/* only the visible part was kept, the rest is transparent */
+		snapshot->cx = snapshot_cx;
+		snapshot->cy = snapshot_cy;
+		snapshot->data.assign((size_t)snapshot_cx * snapshot_cy * 4, 0);
+		if (frozen_frame) {
+			const size_t row = (size_t)frozen_frame->cx * 4;
+			uint8_t *dst = &snapshot->data[((size_t)snapshot_rect.y * snapshot_cx + snapshot_rect.x) * 4];
+			for (uint32_t y = 0; y < frozen_frame->cy; y++)
+				memcpy(dst + (size_t)y * snapshot_cx * 4, &frozen_frame->data[y * row], row);
+		}
+		return snapshot;
+	}
+
+	/* the browser was shut down while hidden, the last frame stays */
+	const CpuFrame *frame = frames.Current();
+	if (!frame || frame->data.empty())
+		return nullptr;
+
+	snapshot->cx = frame->cx;
+	snapshot->cy = frame->cy;
+	snapshot->data.resize((size_t)frame->cx * frame->cy * 4);
+	for (uint32_t y = 0; y < frame->cy; y++)
+		memcpy(&snapshot->data[(size_t)y * frame->cx * 4], &frame->data[(size_t)y * frame->linesize],
+		       (size_t)frame->cx * 4);
+	return snapshot;
+}
+
+void BrowserSource::ServeFrameSnapshots(const uint8_t *data, uint32_t cx, uint32_t cy)
+{
+	std::vector<FrameSnapshotRequest> requests;
+	{
+		std::lock_guard<std::mutex> lock(frame_snapshot_mutex);
+		requests.swap(frame_snapshot_requests);
+		frame_snapshot_pending = false;
+	}
+
+	/* one copy serves every waiting request, encoding happens on the
+	 * snapshot workers */
+	auto snapshot = std::make_shared<FrameSnapshot>();
+	snapshot->data.assign(data, data + (size_t)cx * cy * 4);
+	snapshot->cx = cx;
+	snapshot->cy = cy;
+	snapshot->timestamp = os_gettime_ns();
+
+	for (auto &request : requests)
+		request.promise.set_value(snapshot);
+}
+
 void BrowserSource::SetBrowser(CefRefPtr<CefBrowser> b)
 {
 	std::lock_guard<std::recursive_mutex> auto_lock(lockBrowser);
@@ -495,6 +940,15 @@ void BrowserSource::Update(obs_data_t *settings)
 		bool n_shutdown;
 		bool n_restart;
 		bool n_reroute;
+		bool n_opaque;
+		bool n_snapshot;
+		int n_snapshot_delay;
+		bool n_loop_capture;
+		bool n_async_video;
+		bool n_shm_export;
+		bool n_begin_frame_sync;
+		int n_loop_duration;
+		int n_loop_memory_cap;
 		ControlLevel n_webpage_control_level;
 		std::string n_url;
 		std::string n_css;
@@ -509,9 +963,32 @@ void BrowserSource::Update(obs_data_t *settings)
 		n_css = obs_data_get_string(settings, "css");
 		n_url = obs_data_get_string(settings, n_is_local ? "local_file" : "url");
 		n_reroute = obs_data_get_bool(settings, "reroute_audio");
+		n_opaque = obs_data_get_bool(settings, "opaque");
+		n_snapshot = obs_data_get_bool(settings, "snapshot");
+		n_snapshot_delay = (int)obs_data_get_int(settings, "snapshot_delay");
+		n_loop_capture = obs_data_get_bool(settings, "loop_capture");
+		n_async_video = obs_data_get_bool(settings, "async_video");
+		n_shm_export = obs_data_get_bool(settings, "shm_export");
+		n_begin_frame_sync = obs_data_get_bool(settings, "begin_frame_sync");
+		n_loop_duration = (int)obs_data_get_int(settings, "loop_duration");
+		n_loop_memory_cap = (int)obs_data_get_int(settings, "loop_memory_cap");
 		n_webpage_control_level =
 			static_cast<ControlLevel>(obs_data_get_int(settings, "webpage_control_level"));
 
+		/* checked per frame, no need to recreate the browser */
+		skip_duplicates = obs_data_get_bool(settings, "skip_duplicate_frames");
+		match_displayed_size = obs_data_get_bool(settings, "match_displayed_size");
+		low_latency = obs_data_get_bool(settings, "begin_frame_low_latency");
+		idle_timeout = (int)obs_data_get_int(settings, "idle_timeout") * 1000;
+		idle_fps = (int)obs_data_get_int(settings, "idle_fps");
+		frame_rate_policy = static_cast<FrameRatePolicy>(obs_data_get_int(settings, "frame_rate_policy"));
+		preview_fps = (int)obs_data_get_int(settings, "preview_fps");
+		hidden_fps = (int)obs_data_get_int(settings, "hidden_fps");
+		interaction_boost = obs_data_get_bool(settings, "interaction_boost");
+#if !defined(_WIN32) && !defined(__APPLE__)
+		cpu_priority = static_cast<CpuPriority>(obs_data_get_int(settings, "cpu_priority"));
+#endif
+
 		if (n_is_local && !n_url.empty()) {
 			n_url = CefURIEncode(n_url, false);
 
@@ -554,7 +1031,12 @@ void BrowserSource::Update(obs_data_t *settings)
 
 		if (n_is_local == is_local && n_fps_custom == fps_custom && n_fps == fps &&
 		    n_shutdown == shutdown_on_invisible && n_restart == restart && n_css == css && n_url == url &&
-		    n_reroute == reroute_audio && n_webpage_control_level == webpage_control_level) {
+		    n_reroute == reroute_audio && n_opaque == opaque && n_snapshot == snapshot &&
+		    n_snapshot_delay == snapshot_delay && n_loop_capture == loop_capture &&
+		    n_loop_duration == loop_duration && n_loop_memory_cap == loop_memory_cap &&
+		    n_async_video == async_video && n_shm_export == shm_export &&
+		    n_begin_frame_sync == begin_frame_sync &&
+		    n_webpage_control_level == webpage_control_level) {
 
 			if (n_width == width && n_height == height)
 				return;
@@ -580,6 +1062,15 @@ void BrowserSource::Update(obs_data_t *settings)
 		fps_custom = n_fps_custom;
 		shutdown_on_invisible = n_shutdown;
 		reroute_audio = n_reroute;
+		opaque = n_opaque;
+		snapshot = n_snapshot;
+		snapshot_delay = n_snapshot_delay;
+		loop_capture = n_loop_capture;
+		async_video = n_async_video;
+		shm_export = n_shm_export;
+		begin_frame_sync = n_begin_frame_sync;
+		loop_duration = n_loop_duration;
+		loop_memory_cap = n_loop_memory_cap;
 		webpage_control_level = n_webpage_control_level;
 		restart = n_restart;
 		css = n_css;
@@ -589,7 +1080,27 @@ void BrowserSource::Update(obs_data_t *settings)
 	}
 
 	DestroyBrowser();
+	obs_enter_graphics();
 	DestroyTextures();
+	frames.Clear();
+	popup_frames.Clear();
+	snapshot_frozen = false;
+	frozen_frame.reset();
+	obs_leave_graphics();
+	SetPopupRect(FrameRect());
+	snapshot_load_ts = 0;
+	snapshot_ready_ts = 0;
+	stats.loop_frames = 0;
+	stats.loop_bytes = 0;
+	/* recorded on the CEF thread, reset there once the browser is gone */
+	QueueCEFTask([this]() { loop.Reset(); });
+	if (loop_capture && tex_sharing_avail && hwaccel)
+		blog(LOG_WARNING, "[obs-browser]: Browser source '%s': loop capture needs hardware acceleration off",
+		     obs_source_get_name(source));
+	if (async_video && tex_sharing_avail && hwaccel)
+		blog(LOG_WARNING, "[obs-browser]: Browser source '%s': async video needs hardware acceleration off",
+		     obs_source_get_name(source));
+	UpdateVideoSource();
 #if CHROME_VERSION_BUILD < 4103
 	ClearAudioStreams();
 #endif
@@ -599,31 +1110,604 @@ void BrowserSource::Update(obs_data_t *settings)
 	first_update = false;
 }
 
+/* Smallest device scale used when matching the displayed size; the scale
+ * is rounded up to steps of 1/SCALE_STEPS */
+#define MIN_DEVICE_SCALE 0.25f
+#define SCALE_STEPS 16.0f
+#define SCALE_CHECK_INTERVAL_NS 250000000ULL
+/* A new scale must be stable this long before it is applied, so that
+ * resizing a scene item does not re-layout the page on every step */
+#define SCALE_SETTLE_NS 1000000000ULL
+
+struct DisplayedScale {
+	obs_source_t *source;
+	float parent_scale;
+	float scale;
+};
+
+static float SceneItemScale(obs_sceneitem_t *item, obs_source_t *item_source)
+{
+	struct matrix4 box;
+	struct obs_sceneitem_crop crop;
+	obs_sceneitem_get_box_transform(item, &box);
+	obs_sceneitem_get_crop(item, &crop);
+
+	const float cx = (float)obs_source_get_width(item_source) - (float)(crop.left + crop.right);
+	const float cy = (float)obs_source_get_height(item_source) - (float)(crop.top + crop.bottom);
+	if (cx <= 0.0f || cy <= 0.0f)
+		return 0.0f;
+
+	return std::max(vec3_len(&box.x) / cx, vec3_len(&box.y) / cy);
+}
+
+static bool EnumDisplayedScale(obs_scene_t *, obs_sceneitem_t *item, void *param)
+{
+	DisplayedScale *ds = static_cast<DisplayedScale *>(param);
+	obs_source_t *item_source = obs_sceneitem_get_source(item);
+
+	if (item_source == ds->source) {
+		ds->scale = std::max(ds->scale, ds->parent_scale * SceneItemScale(item, item_source));
+
+	} else if (obs_sceneitem_is_group(item)) {
+		const float parent_scale = ds->parent_scale;
+		ds->parent_scale *= SceneItemScale(item, item_source);
+		obs_sceneitem_group_enum_items(item, EnumDisplayedScale, ds);
+		ds->parent_scale = parent_scale;
+	}
+
+	return true;
+}
+
+static bool EnumScenesDisplayedScale(void *param, obs_source_t *scene_source)
+{
+	DisplayedScale *ds = static_cast<DisplayedScale *>(param);
+	ds->parent_scale = 1.0f;
+	obs_scene_enum_items(obs_scene_from_source(scene_source), EnumDisplayedScale, ds);
+	return true;
+}
+
+void BrowserSource::UpdateDeviceScale()
+{
+	const uint64_t now = os_gettime_ns();
+	float target = 1.0f;
+
+	if (match_displayed_size) {
+		if (now - last_scale_check_ts < SCALE_CHECK_INTERVAL_NS)
+			return;
+		last_scale_check_ts = now;
+
+		/* largest scale of all scene items showing this source */
+		DisplayedScale ds = {source, 1.0f, 0.0f};
+		obs_enum_scenes(EnumScenesDisplayedScale, &ds);
+
+		if (ds.scale > 0.0f)
+			target = std::clamp(std::ceil(ds.scale * SCALE_STEPS) / SCALE_STEPS, MIN_DEVICE_SCALE, 1.0f);
+	}
+
+	if (target == device_scale) {
+		pending_scale = target;
+		return;
+	}
+
+	if (target != pending_scale) {
+		pending_scale = target;
+		pending_scale_ts = now;
+	}
+
+	if (match_displayed_size && now - pending_scale_ts < SCALE_SETTLE_NS)
+		return;
+
+	device_scale = target;
+	ExecuteOnBrowser(
+		[](CefRefPtr<CefBrowser> cefBrowser) {
+			cefBrowser->GetHost()->NotifyScreenInfoChanged();
+			cefBrowser->GetHost()->WasResized();
+			cefBrowser->GetHost()->Invalidate(PET_VIEW);
+		},
+		true);
+}
+
+/* Time given to the page to paint after calling snapshotReady() */
+#define SNAPSHOT_READY_GRACE_NS 200000000ULL
+
+bool BrowserSource::SnapshotDue()
+{
+	const uint64_t now = os_gettime_ns();
+	const uint64_t ready_ts = snapshot_ready_ts;
+	const uint64_t load_ts = snapshot_load_ts;
+
+	if (ready_ts && now - ready_ts >= SNAPSHOT_READY_GRACE_NS)
+		return true;
+	return load_ts && now - load_ts >= (uint64_t)snapshot_delay * 1000000ULL;
+}
+
+void BrowserSource::TakeSnapshot()
+{
+	obs_enter_graphics();
+
+	/* make sure the last painted frame is in the texture, including the
+	 * transparent tiles within the bounds, which are copied as well */
+	ConsumeFrame(frames, texture, opaque ? GS_BGRX : GS_BGRA, texture_valid, true);
+	if (!texture) {
+		obs_leave_graphics();
+		return;
+	}
+
+	snapshot_cx = gs_texture_get_width(texture);
+	snapshot_cy = gs_texture_get_height(texture);
+
+	/* only the visible part of CPU painted frames is kept */
+	FrameRect rect;
+	if (!GetVisibleBounds(rect)) {
+		rect.cx = snapshot_cx;
+		rect.cy = snapshot_cy;
+	}
+
+	gs_texture_t *frozen = nullptr;
+	if (rect.cx) {
+		const gs_color_format format = gs_generalize_format(gs_texture_get_color_format(texture));
+		frozen = AcquirePooledTexture(rect.cx, rect.cy, format, 0);
+		if (frozen)
+			gs_copy_texture_region(frozen, 0, 0, texture, rect.x, rect.y, rect.cx, rect.cy);
+	}
+
+	/* the frame buffers are freed below, keep what get_frame_snapshot
+	 * needs */
+	frozen_frame.reset();
+	const CpuFrame *frame = frames.Current();
+	if (rect.cx && frame && frame->cx == snapshot_cx && frame->cy == snapshot_cy) {
+		frozen_frame = std::make_shared<FrameSnapshot>();
+		frozen_frame->cx = rect.cx;
+		frozen_frame->cy = rect.cy;
+		frozen_frame->data.resize((size_t)rect.cx * rect.cy * 4);
+		for (uint32_t y = 0; y < rect.cy; y++)
+			memcpy(&frozen_frame->data[(size_t)y * rect.cx * 4],
+			       &frame->data[(size_t)(rect.y + y) * frame->linesize + (size_t)rect.x * 4],
+			       (size_t)rect.cx * 4);
+	}
+
+	DestroyTextures();
+	snapshot_texture = frozen;
+	snapshot_rect = rect;
+	snapshot_frozen = true;
+
+	obs_leave_graphics();
+
+	DestroyBrowser();
+
+	/* the frame buffers are written by the CEF thread, free them there
+	 * once the browser is closed */
+	QueueCEFTask([this]() {
+		frames.Reset();
+		popup_frames.Reset();
+	});
+
+	blog(LOG_INFO, "[obs-browser]: Browser source '%s' froze its snapshot and closed its browser",
+	     obs_source_get_name(source));
+}
+
+void BrowserSource::StartLoop()
+{
+	obs_enter_graphics();
+
+	DestroyTextures();
+	snapshot_cx = loop.Width();
+	snapshot_cy = loop.Height();
+	snapshot_rect = FrameRect();
+	snapshot_rect.cx = snapshot_cx;
+	snapshot_rect.cy = snapshot_cy;
+
+	/* starts out with the first frame of the loop */
+	snapshot_texture = AcquirePooledTexture(snapshot_cx, snapshot_cy, opaque ? GS_BGRX : GS_BGRA, GS_DYNAMIC);
+	if (snapshot_texture)
+		gs_texture_set_image(snapshot_texture, loop.Data(), snapshot_cx * 4, false);
+	loop_start_ts = obs_get_video_frame_time();
+	stats.loop_frames = loop.Frames();
+	stats.loop_bytes = loop.Bytes();
+	snapshot_frozen = true;
+
+	obs_leave_graphics();
+
+	DestroyBrowser();
+
+	QueueCEFTask([this]() {
+		frames.Reset();
+		popup_frames.Reset();
+	});
+
+	blog(LOG_INFO, "[obs-browser]: Browser source '%s' captured its loop and closed its browser",
+	     obs_source_get_name(source));
+}
+
+void BrowserSource::RenderLoop()
+{
+	std::vector<FrameRect> rects;
+	bool full;
+
+	/* follows the video clock, so the loop keeps its speed whatever
+	 * the render rate */
+	if (!loop.Seek(obs_get_video_frame_time() - loop_start_ts, rects, full))
+		return;
+
+	const uint64_t start_ns = os_gettime_ns();
+	const size_t full_size = (size_t)snapshot_cx * snapshot_cy * 4;
+	const size_t bytes = UploadFrame(snapshot_texture, loop.Data(), snapshot_cx * 4, snapshot_cx, snapshot_cy,
+					 rects);
+
+	stats.upload_ns += os_gettime_ns() - start_ns;
+	stats.RecordUpload(bytes, bytes < full_size);
+}
+
+void BrowserSource::UpdateVideoSource()
+{
+	if (async_video && !video_source) {
+		obs_source_t *created =
+			obs_source_create_private("browser_source_video", obs_source_get_name(source), nullptr);
+
+		std::lock_guard<std::mutex> lock(video_source_mutex);
+		video_source = created;
+
+	} else if (!async_video && video_source) {
+		obs_source_t *released;
+		{
+			std::lock_guard<std::mutex> lock(video_source_mutex);
+			released = video_source;
+			video_source = nullptr;
+		}
+
+		/* the closed browser paints into it until its close task has
+		 * run on the CEF thread */
+		QueueCEFTask([released]() { obs_source_release(released); });
+		return;
+	}
+
+	if (video_source)
+		obs_source_output_video(video_source, nullptr);
+}
+
+void BrowserSource::RenderAsyncVideo()
+{
+	std::lock_guard<std::mutex> lock(video_source_mutex);
+	if (!video_source)
+		return;
+
+	const uint32_t cx = obs_source_get_width(video_source);
+	const uint32_t cy = obs_source_get_height(video_source);
+	if (!cx || !cy)
+		return;
+
+	gs_matrix_push();
+	if (match_displayed_size && width > 0 && height > 0)
+		gs_matrix_scale3f((float)width / (float)cx, (float)height / (float)cy, 1.0f);
+	obs_source_video_render(video_source);
+	gs_matrix_pop();
+
+	stats.last_drawn_pixels = (uint64_t)cx * cy;
+}
+
+void BrowserSource::EnumActiveSources(obs_source_enum_proc_t cb, void *param)
+{
+	{
+		std::lock_guard<std::mutex> lock(video_source_mutex);
+		if (video_source)
+			cb(source, video_source, param);
+	}
+#if CHROME_VERSION_BUILD < 4103
+	EnumAudioStreams(cb, param);
+#endif
+}
+
 void BrowserSource::Tick()
 {
 	if (create_browser && CreateBrowser())
 		create_browser = false;
-#if defined(ENABLE_BROWSER_SHARED_TEXTURE)
-#if defined(BROWSER_EXTERNAL_BEGIN_FRAME_ENABLED)
-	if (!fps_custom)
-		reset_frame = true;
-#else
+	if (async_video) {
+		/* frames go through libobs, there is nothing to freeze */
+	} else if (loop_capture && !snapshot_frozen && cefBrowser && loop.Complete()) {
+		StartLoop();
+	} else if (loop_capture && !snapshot_frozen && cefBrowser && loop.Due(os_gettime_ns())) {
+		/* recorded on the CEF thread, finished there */
+		if (!loop_finish_queued.exchange(true))
+			QueueCEFTask([this]() {
+				loop.Finish(os_gettime_ns());
+				loop_finish_queued = false;
+			});
+	} else if (snapshot && !loop_capture && !snapshot_frozen && cefBrowser && SnapshotDue()) {
+		TakeSnapshot();
+	}
+	UpdateDeviceScale();
+
 	struct obs_video_info ovi;
 	obs_get_video_info(&ovi);
 	double video_fps = (double)ovi.fps_num / (double)ovi.fps_den;
 
+	if (external_begin_frames)
+		max_frame_rate = video_fps;
+	boost_frame_rate = video_fps;
+#if defined(ENABLE_BROWSER_SHARED_TEXTURE)
+#if defined(BROWSER_EXTERNAL_BEGIN_FRAME_ENABLED)
+	if (!fps_custom && TakeBeginFrame(video_fps))
+		reset_frame = true;
+#else
 	if (!fps_custom) {
 		if (!!cefBrowser && canvas_fps != video_fps) {
-			cefBrowser->GetHost()->SetWindowlessFrameRate(video_fps);
+			max_frame_rate = video_fps;
 			canvas_fps = video_fps;
 		}
 	}
 #endif
 #endif
+	UpdateFrameRate();
 }
 
 extern void ProcessCef();
 
+static inline bool CoversFrame(const std::vector<FrameRect> &valid, uint32_t cx, uint32_t cy)
+{
+	return valid.size() == 1 && !valid[0].x && !valid[0].y && valid[0].cx == cx && valid[0].cy == cy;
+}
+
+/* whole is for callers that use all of the texture rather than only its
+ * live tiles, the stale tiles are uploaded for them first */
+void BrowserSource::ConsumeFrame(FrameQueue &queue, gs_texture_t *&tex, gs_color_format format,
+				 std::vector<FrameRect> &valid, bool whole)
+{
+	CpuFrame *frame = queue.Pop();
+	if (!frame) {
+		/* textures were released while hidden, restore the last frame */
+		if (!(frame = queue.Current()))
+			return;
+		if (tex && (!whole || CoversFrame(valid, frame->cx, frame->cy)))
+			return;
+		frame->full = true;
+	}
+
+	if (tex && (gs_texture_get_width(tex) != frame->cx || gs_texture_get_height(tex) != frame->cy ||
+		    gs_texture_get_color_format(tex) != format)) {
+		ReleasePooledTexture(tex);
+		tex = nullptr;
+	}
+
+	const size_t full_size = (size_t)frame->linesize * frame->cy;
+	const uint64_t start_ns = os_gettime_ns();
+	size_t bytes = full_size;
+
+	if (!tex) {
+		/* create empty and fill through a map, so that the backend's
+		 * upload buffer holds the full frame for later partial
+		 * uploads */
+		tex = AcquirePooledTexture(frame->cx, frame->cy, format, GS_DYNAMIC);
+		if (!tex)
+			return;
+		gs_texture_set_image(tex, frame->data.data(), frame->linesize, false);
+	} else if (whole) {
+		std::vector<FrameRect> &rects = frame->rects;
+		if (frame->full || !CoversFrame(valid, frame->cx, frame->cy))
+			rects.assign(1, FrameRect{0, 0, frame->cx, frame->cy});
+
+		if (rects.empty())
+			bytes = 0;
+		else
+			bytes = UploadFrame(tex, frame->data.data(), frame->linesize, frame->cx, frame->cy, rects);
+	} else {
+		/* transparent tiles are never drawn, so they are not
+		 * uploaded either.  Tiles that were transparent in the
+		 * frames before are stale and go up whole. */
+		std::vector<FrameRect> &rects = frame->rects;
+		if (frame->full) {
+			rects = frame->live;
+		} else {
+			IntersectFrameRects(rects, frame->live);
+			AddUncoveredRects(rects, frame->live, valid);
+		}
+
+		if (rects.empty())
+			bytes = 0;
+		else
+			bytes = UploadFrame(tex, frame->data.data(), frame->linesize, frame->cx, frame->cy, rects);
+	}
+
+	if (whole || bytes == full_size)
+		valid.assign(1, FrameRect{0, 0, frame->cx, frame->cy});
+	else
+		valid = frame->live;
+
+	stats.upload_ns += os_gettime_ns() - start_ns;
+	stats.RecordUpload(bytes, bytes < full_size);
+	frame_generation++;
+}
+
+void BrowserSource::RenderSnapshot(bool flip)
+{
+	/* nothing was visible when the snapshot was taken */
+	if (!snapshot_texture)
+		return;
+
+	gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+
+	const bool previous = gs_framebuffer_srgb_enabled();
+	gs_enable_framebuffer_srgb(true);
+
+	gs_blend_state_push();
+	if (opaque)
+		gs_enable_blending(false);
+	else
+		gs_blend_function(GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+
+	gs_eparam_t *const image = gs_effect_get_param_by_name(effect, "image");
+	gs_effect_set_texture_srgb(image, snapshot_texture);
+
+	gs_matrix_push();
+	if (match_displayed_size && width > 0 && height > 0)
+		gs_matrix_scale3f((float)width / (float)snapshot_cx, (float)height / (float)snapshot_cy, 1.0f);
+	gs_matrix_translate3f((float)snapshot_rect.x, (float)snapshot_rect.y, 0.0f);
+
+	while (gs_effect_loop(effect, "Draw"))
+		gs_draw_sprite(snapshot_texture, flip ? GS_FLIP_V : 0, 0, 0);
+
+	gs_matrix_pop();
+
+	gs_blend_state_pop();
+
+	gs_enable_framebuffer_srgb(previous);
+	stats.last_drawn_pixels = snapshot_rect.Area();
+}
+
+void BrowserSource::RenderPopup()
+{
+	FrameRect rect;
+	{
+		std::lock_guard<std::mutex> lock(popup_mutex);
+		rect = popup_rect;
+	}
+
+	if (!rect.cx) {
+		if (popup_texture) {
+#if !defined(_WIN32) && !defined(__APPLE__)
+			if (!popup_dmabuf_cache.Owns(popup_texture))
+#endif
+				ReleasePooledTexture(popup_texture);
+			popup_texture = nullptr;
+
+			/* drop anything painted before the popup closed */
+			popup_frames.Pop();
+			popup_frames.Clear();
+		}
+#if !defined(_WIN32) && !defined(__APPLE__)
+		popup_dmabuf_cache.Clear();
+#elif defined(ENABLE_BROWSER_SHARED_TEXTURE) && defined(_WIN32)
+		last_popup_handle = INVALID_HANDLE_VALUE;
+#elif defined(ENABLE_BROWSER_SHARED_TEXTURE)
+		last_popup_handle = nullptr;
+#endif
+		return;
+	}
+
+	/* shared texture popups are replaced by the paint callbacks, only
+	 * CPU painted ones come through popup_frames */
+	ConsumeFrame(popup_frames, popup_texture, GS_BGRA, popup_valid, true);
+	if (!popup_texture)
+		return;
+
+	bool flip = false;
+#if defined(ENABLE_BROWSER_SHARED_TEXTURE) && CHROME_VERSION_BUILD < 6367
+	flip = hwaccel;
+#endif
+
+#ifdef __APPLE__
+	gs_effect_t *effect = obs_get_base_effect((hwaccel) ? OBS_EFFECT_DEFAULT_RECT : OBS_EFFECT_DEFAULT);
+#else
+	gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+#endif
+
+	const bool previous = gs_framebuffer_srgb_enabled();
+	gs_enable_framebuffer_srgb(true);
+
+	gs_blend_state_push();
+	gs_blend_function(GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+
+	/* shared textures may lack an sRGB view, those are decoded in the
+	 * shader rather than copied as the view texture is */
+	gs_eparam_t *const image = gs_effect_get_param_by_name(effect, "image");
+	const gs_color_format format = gs_texture_get_color_format(popup_texture);
+	const char *tech;
+	if (gs_generalize_format(format) == format) {
+		gs_effect_set_texture_srgb(image, popup_texture);
+		tech = "Draw";
+	} else {
+		gs_effect_set_texture(image, popup_texture);
+		tech = "DrawSrgbDecompress";
+	}
+
+	gs_matrix_push();
+	gs_matrix_translate3f((float)rect.x, (float)rect.y, 0.0f);
+
+	/* the popup rect is in view coordinates, the texture may have been
+	 * painted at a different device scale */
+	while (gs_effect_loop(effect, tech))
+		gs_draw_sprite(popup_texture, flip ? GS_FLIP_V : 0, rect.cx, rect.cy);
+
+	gs_matrix_pop();
+
+	gs_blend_state_pop();
+
+	gs_enable_framebuffer_srgb(previous);
+}
+
+void BrowserSource::DrawTiles(gs_effect_t *effect, const char *tech, gs_texture_t *tex,
+			      const std::vector<FrameRect> &live)
+{
+	const size_t num = live.size() * 6;
+	if (!num)
+		return;
+
+	if (!tiles_vb || tiles_vb_size < num) {
+		gs_vertexbuffer_destroy(tiles_vb);
+		tiles_vb_size = std::max(num, tiles_vb_size * 2);
+
+		struct gs_vb_data *vbd = gs_vbdata_create();
+		vbd->num = tiles_vb_size;
+		vbd->points = (struct vec3 *)bzalloc(sizeof(struct vec3) * tiles_vb_size);
+		vbd->num_tex = 1;
+		vbd->tvarray = (struct gs_tvertarray *)bzalloc(sizeof(struct gs_tvertarray));
+		vbd->tvarray[0].width = 2;
+		vbd->tvarray[0].array = bzalloc(sizeof(struct vec2) * tiles_vb_size);
+		tiles_vb = gs_vertexbuffer_create(vbd, GS_DYNAMIC);
+		if (!tiles_vb) {
+			tiles_vb_size = 0;
+			return;
+		}
+	}
+
+	struct gs_vb_data *vbd = gs_vertexbuffer_get_data(tiles_vb);
+	struct vec3 *points = vbd->points;
+	struct vec2 *uvs = (struct vec2 *)vbd->tvarray[0].array;
+	const float cx = (float)gs_texture_get_width(tex);
+	const float cy = (float)gs_texture_get_height(tex);
+
+	/* two triangles per run of live tiles */
+	for (const FrameRect &run : live) {
+		const float x[2] = {(float)run.x, (float)(run.x + run.cx)};
+		const float y[2] = {(float)run.y, (float)(run.y + run.cy)};
+		const int corners[6][2] = {{0, 0}, {1, 0}, {0, 1}, {1, 0}, {1, 1}, {0, 1}};
+
+		for (const auto &corner : corners) {
+			vec3_set(points++, x[corner[0]], y[corner[1]], 0.0f);
+			vec2_set(uvs++, x[corner[0]] / cx, y[corner[1]] / cy);
+		}
+	}
+
+	gs_vertexbuffer_flush(tiles_vb);
+	gs_load_vertexbuffer(tiles_vb);
+	gs_load_indexbuffer(nullptr);
+
+	while (gs_effect_loop(effect, tech))
+		gs_draw(GS_TRIS, 0, (uint32_t)num);
+
+	gs_load_vertexbuffer(nullptr);
+}
+
+CpuFrame *BrowserSource::GetVisibleBounds(FrameRect &bounds)
+{
+	/* only CPU painted frames carry their bounds */
+	CpuFrame *frame = frames.Current();
+	if (!frame || frame->cx != gs_texture_get_width(texture) || frame->cy != gs_texture_get_height(texture))
+		return nullptr;
+
+	bounds = frame->bounds;
+	if (!bounds.cx)
+		return frame;
+
+	/* pad by a pixel so that filtering at the edges matches a full draw */
+	const uint32_t right = std::min(bounds.x + bounds.cx + 1, frame->cx);
+	const uint32_t bottom = std::min(bounds.y + bounds.cy + 1, frame->cy);
+	bounds.x = bounds.x ? bounds.x - 1 : 0;
+	bounds.y = bounds.y ? bounds.y - 1 : 0;
+	bounds.cx = right - bounds.x;
+	bounds.cy = bottom - bounds.y;
+	return frame;
+}
+
 void BrowserSource::Render()
 {
 	bool flip = false;
@@ -631,7 +1715,46 @@ void BrowserSource::Render()
 	flip = hwaccel;
 #endif
 
-	if (texture) {
+	const uint64_t start_ns = os_gettime_ns();
+
+	if (async_video) {
+		RenderAsyncVideo();
+
+		stats.render_ns += os_gettime_ns() - start_ns;
+		stats.renders++;
+#ifdef ENABLE_BROWSER_QT_LOOP
+		ProcessCef();
+#endif
+		return;
+	}
+
+	if (snapshot_frozen) {
+		/* the browser is closed, only its last frame or its
+		 * recorded loop is left */
+		if (loop.Complete() && snapshot_texture)
+			RenderLoop();
+		RenderSnapshot(flip);
+
+		stats.render_ns += os_gettime_ns() - start_ns;
+		stats.renders++;
+#ifdef ENABLE_BROWSER_QT_LOOP
+		ProcessCef();
+#endif
+		return;
+	}
+
+	/* the alpha channel of opaque pages is ignored */
+	const uint64_t generation = frame_generation;
+	ConsumeFrame(frames, texture, opaque ? GS_BGRX : GS_BGRA, texture_valid, flip);
+	if (cpu_begin_frames && frame_generation != generation)
+		begin_frame_timing->OnRender(start_ns);
+
+	FrameRect bounds;
+	const CpuFrame *frame = texture && !flip ? GetVisibleBounds(bounds) : nullptr;
+	const bool cropped = frame != nullptr;
+	const bool transparent = cropped && !bounds.cx;
+
+	if (texture && !transparent) {
 #ifdef __APPLE__
 		gs_effect_t *effect = obs_get_base_effect((hwaccel) ? OBS_EFFECT_DEFAULT_RECT : OBS_EFFECT_DEFAULT);
 #else
@@ -641,7 +1764,20 @@ void BrowserSource::Render()
 		bool linear_sample = extra_texture == NULL;
 		gs_texture_t *draw_texture = texture;
 		if (!linear_sample && !obs_source_get_texcoords_centered(source)) {
-			gs_copy_texture(extra_texture, texture);
+			/* render is called once per view (program, preview,
+			 * projectors), the texture only changes once per paint */
+			const uint64_t generation = frame_generation;
+			if (generation == copied_generation) {
+				stats.copies_skipped++;
+			} else if (cropped) {
+				gs_copy_texture_region(extra_texture, bounds.x, bounds.y, texture, bounds.x, bounds.y,
+						       bounds.cx, bounds.cy);
+				stats.texture_copies++;
+			} else {
+				gs_copy_texture(extra_texture, texture);
+				stats.texture_copies++;
+			}
+			copied_generation = generation;
 			draw_texture = extra_texture;
 
 			linear_sample = true;
@@ -651,7 +1787,10 @@ void BrowserSource::Render()
 		gs_enable_framebuffer_srgb(true);
 
 		gs_blend_state_push();
-		gs_blend_function(GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+		if (opaque)
+			gs_enable_blending(false);
+		else
+			gs_blend_function(GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
 
 		gs_eparam_t *const image = gs_effect_get_param_by_name(effect, "image");
 
@@ -664,15 +1803,59 @@ void BrowserSource::Render()
 			tech = "DrawSrgbDecompress";
 		}
 
+		/* frames are rendered at the displayed size, but the source
+		 * keeps its logical size */
+		const bool scaled = match_displayed_size && width > 0 && height > 0;
+		if (scaled) {
+			gs_matrix_push();
+			gs_matrix_scale3f((float)width / (float)gs_texture_get_width(draw_texture),
+					  (float)height / (float)gs_texture_get_height(draw_texture), 1.0f);
+		}
+
 		const uint32_t flip_flag = flip ? GS_FLIP_V : 0;
-		while (gs_effect_loop(effect, tech))
-			gs_draw_sprite(draw_texture, flip_flag, 0, 0);
+		if (cropped && !opaque) {
+			/* transparent tiles were not uploaded, draw around them
+			 * in a single batch */
+			DrawTiles(effect, tech, draw_texture, frame->live);
+
+			uint64_t pixels = 0;
+			for (const FrameRect &run : frame->live)
+				pixels += run.Area();
+			stats.last_drawn_pixels = pixels;
+		} else if (cropped) {
+			gs_matrix_push();
+			gs_matrix_translate3f((float)bounds.x, (float)bounds.y, 0.0f);
+
+			while (gs_effect_loop(effect, tech))
+				gs_draw_sprite_subregion(draw_texture, flip_flag, bounds.x, bounds.y, bounds.cx,
+							 bounds.cy);
+
+			gs_matrix_pop();
+			stats.last_drawn_pixels = bounds.Area();
+		} else {
+			while (gs_effect_loop(effect, tech))
+				gs_draw_sprite(draw_texture, flip_flag, 0, 0);
+
+			stats.last_drawn_pixels =
+				(uint64_t)gs_texture_get_width(draw_texture) * gs_texture_get_height(draw_texture);
+		}
+
+		if (scaled)
+			gs_matrix_pop();
 
 		gs_blend_state_pop();
 
 		gs_enable_framebuffer_srgb(previous);
+	} else if (transparent) {
+		stats.last_drawn_pixels = 0;
 	}
 
+	if (texture)
+		RenderPopup();
+
+	stats.render_ns += os_gettime_ns() - start_ns;
+	stats.renders++;
+
 #if defined(BROWSER_EXTERNAL_BEGIN_FRAME_ENABLED) && defined(ENABLE_BROWSER_SHARED_TEXTURE)
 	SignalBeginFrame();
 #elif defined(ENABLE_BROWSER_QT_LOOP)
@@ -690,6 +1873,119 @@ static void ExecuteOnBrowser(BrowserFunc func, BrowserSource *bs)
 	}
 }
 
+/* Called once per OBS frame.  Every CPU painted browser driven by begin
+ * frames gets one, all in a single task, unless the frame it painted for
+ * the previous one has not been rendered yet. */
+void SendBeginFrames()
+{
+	struct obs_video_info ovi;
+	if (!obs_get_video_info(&ovi))
+		return;
+
+	const uint64_t interval = 1000000000ULL * ovi.fps_den / ovi.fps_num;
+	const double video_fps = (double)ovi.fps_num / (double)ovi.fps_den;
+	const uint64_t frame_ts = obs_get_video_frame_time();
+	const uint64_t next_frame_ts = frame_ts + interval;
+	const uint64_t now = os_gettime_ns();
+	std::vector<BeginFrameRequest> requests;
+
+	lock_guard<mutex> lock(browser_list_mutex);
+
+	for (BrowserSource *bs = first_browser; bs; bs = bs->next) {
+		if (!bs->cpu_begin_frames)
+			continue;
+
+		BeginFrameTiming &timing = *bs->begin_frame_timing;
+		/* a begin frame sent ahead of the frame it is meant for, in low
+		 * latency mode, may paint between this tick and its render.  As
+		 * long as paints are known to fit in a frame, the next one is
+		 * not sent before the frame after, by when it has long painted. */
+		const bool due = bs->low_latency && timing.paint_ns && timing.lead_ns < interval &&
+				 timing.target_ts <= frame_ts;
+		if (timing.Outstanding(now, interval) && !due) {
+			bs->stats.begin_frames_skipped++;
+			continue;
+		}
+
+		CefRefPtr<CefBrowser> browser = bs->GetBrowser();
+		if (!browser || !bs->TakeBeginFrame(video_fps))
+			continue;
+
+		timing.OnRequest(now);
+		timing.target_ts = next_frame_ts;
+		bs->stats.begin_frames++;
+
+		/* low latency: sent just early enough for the paint to make
+		 * it into the next frame, rather than a frame late */
+		const uint64_t lead = bs->low_latency ? timing.Lead(interval) : interval;
+		if (lead < interval)
+			ScheduleBeginFrame({browser, bs->begin_frame_timing}, next_frame_ts - lead);
+		else
+			requests.push_back({browser, bs->begin_frame_timing});
+	}
+
+	SendBeginFrameBatch(std::move(requests));
+}
+
+void SetFrameRatePolicy(obs_data_t *data)
+{
+	if (obs_data_has_user_value(data, "enabled"))
+		tiers_enabled = obs_data_get_bool(data, "enabled");
+	if (obs_data_has_user_value(data, "preview_fps"))
+		tiers_preview_fps = std::clamp((int)obs_data_get_int(data, "preview_fps"), 1, 60);
+	if (obs_data_has_user_value(data, "hidden_fps"))
+		tiers_hidden_fps = std::clamp((int)obs_data_get_int(data, "hidden_fps"), 1, 60);
+
+	lock_guard<mutex> lock(browser_list_mutex);
+	for (BrowserSource *bs = first_browser; bs; bs = bs->next)
+		bs->ApplyFrameRate();
+}
+
+void GetFrameRatePolicy(obs_data_t *data)
+{
+	obs_data_set_bool(data, "enabled", tiers_enabled);
+	obs_data_set_int(data, "preview_fps", tiers_preview_fps);
+	obs_data_set_int(data, "hidden_fps", tiers_hidden_fps);
+}
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+void CollectCpuGovernorSources(std::vector<CpuGovernorSource> &sources)
+{
+	lock_guard<mutex> lock(browser_list_mutex);
+
+	for (BrowserSource *bs = first_browser; bs; bs = bs->next) {
+		CpuGovernorSource source;
+		source.id = bs;
+		source.name = obs_source_get_name(bs->source);
+		source.pid = bs->renderer_pid;
+		source.priority = bs->cpu_priority;
+		source.program = bs->is_active;
+		source.frame_rate = bs->frame_rate;
+		source.max_frame_rate = bs->max_frame_rate;
+		source.limit = bs->governor_frame_rate;
+		sources.push_back(std::move(source));
+	}
+}
+
+void ApplyCpuGovernorLimits(const std::vector<CpuGovernorSource> &sources)
+{
+	lock_guard<mutex> lock(browser_list_mutex);
+
+	/* sources may have gone since they were collected, only the ones
+	 * still in the list are touched */
+	for (BrowserSource *bs = first_browser; bs; bs = bs->next) {
+		for (const CpuGovernorSource &source : sources) {
+			if (source.id != bs || source.pid != bs->renderer_pid)
+				continue;
+
+			if (bs->governor_frame_rate.exchange(source.limit) != source.limit)
+				bs->ApplyFrameRate();
+			break;
+		}
+	}
+}
+#endif
+
 static void ExecuteOnAllBrowsers(BrowserFunc func)
 {
 	lock_guard<mutex> lock(browser_list_mutex);
@@ -713,8 +2009,15 @@ void DispatchJSEvent(std::string eventName, std::string jsonString, BrowserSourc
 		SendBrowserProcessMessage(cefBrowser, PID_RENDERER, msg);
 	};
 
-	if (!browser)
+	if (!browser) {
+		{
+			lock_guard<mutex> lock(browser_list_mutex);
+			for (BrowserSource *bs = first_browser; bs; bs = bs->next)
+				bs->MarkActivity();
+		}
 		ExecuteOnAllBrowsers(jsEvent);
-	else
+	} else {
+		browser->MarkActivity();
 		ExecuteOnBrowser(jsEvent, browser);
+	}
 }
@@ -22,11 +22,23 @@
 
 #include "cef-headers.hpp"
 #include "browser-app.hpp"
+#include "browser-begin-frame.hpp"
+#include "browser-frame.hpp"
+#include "browser-loop.hpp"
+#include "browser-snapshot.hpp"
+#include "browser-texture-pool.hpp"
 #include <atomic>
 #include <functional>
+#include <future>
+#include <memory>
 #include <string>
 #include <mutex>
 
+#if !defined(_WIN32) && !defined(__APPLE__)
+#include "browser-cpu-governor.hpp"
+#include "browser-dmabuf-cache.hpp"
+#endif
+
 #if CHROME_VERSION_BUILD < 4103
 #include <obs.hpp>
 #include <unordered_map>
@@ -50,8 +62,53 @@ enum class ControlLevel : int {
 };
 inline constexpr ControlLevel DEFAULT_CONTROL_LEVEL = ControlLevel::ReadObs;
 
+/* Which frame rate tiers a source follows when it is not on program */
+enum class FrameRatePolicy : int {
+	Global,
+	Full,
+	Custom,
+};
+
 extern bool hwaccel;
 
+struct BrowserSourceStats {
+	std::atomic<uint64_t> frames_uploaded = 0;
+	std::atomic<uint64_t> partial_uploads = 0;
+	std::atomic<uint64_t> bytes_uploaded = 0;
+	std::atomic<uint64_t> last_frame_bytes = 0;
+	std::atomic<uint64_t> frames_dropped = 0;
+	std::atomic<uint64_t> duplicate_frames = 0;
+	std::atomic<uint64_t> hash_ns = 0;
+	std::atomic<uint64_t> upload_ns = 0;
+	std::atomic<uint64_t> last_drawn_pixels = 0;
+	std::atomic<uint64_t> texture_copies = 0;
+	std::atomic<uint64_t> copies_skipped = 0;
+	std::atomic<uint64_t> renders = 0;
+	std::atomic<uint64_t> render_ns = 0;
+	std::atomic<uint64_t> loop_frames = 0;
+	std::atomic<uint64_t> loop_bytes = 0;
+	std::atomic<uint64_t> async_frames = 0;
+	std::atomic<uint64_t> convert_ns = 0;
+	std::atomic<uint64_t> begin_frames = 0;
+	std::atomic<uint64_t> begin_frames_skipped = 0;
+	std::atomic<uint64_t> begin_frames_decimated = 0;
+	std::atomic<uint64_t> idle_transitions = 0;
+	std::atomic<uint64_t> active_transitions = 0;
+	std::atomic<uint64_t> boosts = 0;
+	std::atomic<uint64_t> input_latency_ns = 0;
+	std::atomic<uint64_t> input_latency_samples = 0;
+	std::atomic<uint64_t> page_frame_requests = 0;
+
+	inline void RecordUpload(size_t bytes, bool partial)
+	{
+		frames_uploaded++;
+		if (partial)
+			partial_uploads++;
+		bytes_uploaded += bytes;
+		last_frame_bytes = bytes;
+	}
+};
+
 struct BrowserSource {
 	BrowserSource **p_prev_next = nullptr;
 	BrowserSource *next = nullptr;
@@ -74,9 +131,24 @@ struct BrowserSource {
 #ifdef ENABLE_BROWSER_SHARED_TEXTURE
 #ifdef _WIN32
 	void *last_handle = INVALID_HANDLE_VALUE;
+	void *last_popup_handle = INVALID_HANDLE_VALUE;
 #elif defined(__APPLE__)
 	void *last_handle = nullptr;
+	void *last_popup_handle = nullptr;
+#endif
 #endif
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+	/* own texture and popup_texture while they come from a dmabuf */
+	DmabufTextureCache dmabuf_cache;
+	DmabufTextureCache popup_dmabuf_cache;
+
+	/* CPU governor: the renderer's pid as reported by the renderer once
+	 * a page is loaded, and the rate the governor holds the source to
+	 * while it is not on program, 0 for none */
+	std::atomic<int> renderer_pid = 0;
+	std::atomic<CpuPriority> cpu_priority = CpuPriority::Normal;
+	std::atomic<double> governor_frame_rate = 0.0;
 #endif
 
 	int width = 0;
@@ -89,27 +161,181 @@ struct BrowserSource {
 	bool is_local = false;
 	bool first_update = true;
 	bool reroute_audio = true;
+	bool opaque = false;
+	bool snapshot = false;
+	int snapshot_delay = 0;
+	bool loop_capture = false;
+	int loop_duration = 0;
+	int loop_memory_cap = 0;
+	bool async_video = false;
+	bool shm_export = false;
+	bool begin_frame_sync = false;
+	/* the CPU painted browser renders on begin frames sent once per OBS
+	 * frame by SendBeginFrames */
+	std::atomic<bool> cpu_begin_frames = false;
+	std::atomic<bool> low_latency = false;
+	std::shared_ptr<BeginFrameTiming> begin_frame_timing = std::make_shared<BeginFrameTiming>();
+	std::atomic<bool> skip_duplicates = false;
+
+	/* frame rate governors.  max_frame_rate is the rate the browser was
+	 * created with, and frame_rate the one applied, lowered to idle_fps
+	 * once nothing was painted for idle_timeout ms.  Browsers driven by
+	 * external begin frames have them decimated, others get their
+	 * windowless frame rate changed. */
+	std::atomic<double> max_frame_rate = 0.0;
+	std::atomic<double> frame_rate = 0.0;
+	std::atomic<bool> external_begin_frames = false;
+	double begin_frame_credit = 0.0;
+	std::atomic<int> idle_timeout = 0;
+	std::atomic<int> idle_fps = 1;
+	std::atomic<uint64_t> last_activity_ts = 0;
+	std::atomic<bool> idle = false;
+	/* tiers: full rate on program, preview_fps when only showing in the
+	 * preview or a projector, hidden_fps when not showing at all */
+	std::atomic<FrameRatePolicy> frame_rate_policy = FrameRatePolicy::Global;
+	std::atomic<int> preview_fps = 15;
+	std::atomic<int> hidden_fps = 1;
+	/* interaction boost: input raises the rate to the canvas rate until
+	 * no input came for a few seconds.  input_ts is the first input not
+	 * followed by a paint yet, for the input to paint latency. */
+	std::atomic<bool> interaction_boost = true;
+	std::atomic<double> boost_frame_rate = 60.0;
+	std::atomic<uint64_t> boost_until_ts = 0;
+	std::atomic<uint64_t> boost_begin_frame_ts = 0;
+	std::atomic<uint64_t> input_ts = 0;
+	/* set by the page through window.obsstudio: page_frame_rate caps
+	 * the rate (0 for no cap), and a paused page only paints frames it
+	 * asks for, page_frame_pending until that frame is painted */
+	std::atomic<double> page_frame_rate = 0.0;
+	std::atomic<bool> page_paused = false;
+	std::atomic<bool> page_frame_pending = false;
+	std::atomic<bool> match_displayed_size = false;
 	std::atomic<bool> destroying = false;
 	ControlLevel webpage_control_level = DEFAULT_CONTROL_LEVEL;
 #if defined(BROWSER_EXTERNAL_BEGIN_FRAME_ENABLED) && defined(ENABLE_BROWSER_SHARED_TEXTURE)
 	bool reset_frame = false;
 #endif
-	bool is_showing = false;
+	std::atomic<bool> is_showing = false;
+	std::atomic<bool> is_active = false;
+	FrameQueue frames;
+	BrowserSourceStats stats;
+
+	/* parts of texture and popup_texture that hold the last frame taken;
+	 * transparent tiles are not uploaded, so what they hold is stale */
+	std::vector<FrameRect> texture_valid;
+	std::vector<FrameRect> popup_valid;
+
+	/* async video mode: CPU frames are handed to this private source
+	 * with a timestamp, and libobs buffers and paces them against the
+	 * audio.  Only exists while the mode is on, as libobs enumerates it
+	 * as a child of the source. */
+	obs_source_t *video_source = nullptr;
+	std::mutex video_source_mutex;
+
+	/* snapshot mode: once the page has settled, its last frame is kept
+	 * and the browser is closed until the source is updated or
+	 * refreshed */
+	std::atomic<uint64_t> snapshot_load_ts = 0;
+	std::atomic<uint64_t> snapshot_ready_ts = 0;
+	std::atomic<bool> snapshot_frozen = false;
+	gs_texture_t *snapshot_texture = nullptr;
+	FrameRect snapshot_rect;
+	uint32_t snapshot_cx = 0;
+	uint32_t snapshot_cy = 0;
+
+	/* loop mode: a few seconds of frames are recorded, then the browser
+	 * is closed and the recording replayed through snapshot_texture */
+	FrameLoop loop;
+	uint64_t loop_start_ts = 0;
+	/* set while Tick waits for the CEF thread to finish a recording
+	 * that reached its duration without a paint to end it */
+	std::atomic<bool> loop_finish_queued = false;
+
+	/* get_frame_snapshot requests waiting for the next view paint */
+	struct FrameSnapshotRequest {
+		uint64_t id;
+		std::promise<std::shared_ptr<FrameSnapshot>> promise;
+	};
+	std::mutex frame_snapshot_mutex;
+	std::vector<FrameSnapshotRequest> frame_snapshot_requests;
+	uint64_t frame_snapshot_next_id = 0;
+	std::atomic<bool> frame_snapshot_pending = false;
+
+	/* CPU copy of the visible part of a frozen snapshot, snapshot_rect,
+	 * for get_frame_snapshot once the browser is gone */
+	std::shared_ptr<FrameSnapshot> frozen_frame;
+
+	gs_vertbuffer_t *tiles_vb = nullptr;
+	size_t tiles_vb_size = 0;
+
+	/* bumped by the paint paths whenever texture gets new content, so
+	 * that views rendering the same frame share one sRGB copy.
+	 * copied_generation is NO_GENERATION while extra_texture holds no
+	 * copy, after it was created or released. */
+	static constexpr uint64_t NO_GENERATION = UINT64_MAX;
+	std::atomic<uint64_t> frame_generation = 0;
+	uint64_t copied_generation = NO_GENERATION;
+
+	/* device scale factor reported to CEF, so that sources shown scaled
+	 * down are rasterized at their displayed size */
+	std::atomic<float> device_scale = 1.0f;
+	float pending_scale = 1.0f;
+	uint64_t pending_scale_ts = 0;
+	uint64_t last_scale_check_ts = 0;
+
+	/* select dropdowns and other popups, painted separately and
+	 * composited over the view */
+	FrameQueue popup_frames;
+	gs_texture_t *popup_texture = nullptr;
+	std::mutex popup_mutex;
+	FrameRect popup_rect;
+
+	inline void SetPopupRect(const FrameRect &rect)
+	{
+		std::lock_guard<std::mutex> lock(popup_mutex);
+		popup_rect = rect;
+	}
 
 	inline void DestroyTextures()
 	{
 		obs_enter_graphics();
 		if (extra_texture) {
-			gs_texture_destroy(extra_texture);
+			ReleasePooledTexture(extra_texture);
 			extra_texture = nullptr;
+			copied_generation = NO_GENERATION;
 			last_cx = 0;
 			last_cy = 0;
 			last_format = GS_UNKNOWN;
 		}
 		if (texture) {
-			gs_texture_destroy(texture);
+#if !defined(_WIN32) && !defined(__APPLE__)
+			if (!dmabuf_cache.Owns(texture))
+#endif
+				ReleasePooledTexture(texture);
 			texture = nullptr;
 		}
+#if !defined(_WIN32) && !defined(__APPLE__)
+		dmabuf_cache.Clear();
+#endif
+		if (popup_texture) {
+#if !defined(_WIN32) && !defined(__APPLE__)
+			if (!popup_dmabuf_cache.Owns(popup_texture))
+#endif
+				ReleasePooledTexture(popup_texture);
+			popup_texture = nullptr;
+		}
+#if !defined(_WIN32) && !defined(__APPLE__)
+		popup_dmabuf_cache.Clear();
+#endif
+		if (snapshot_texture) {
+			ReleasePooledTexture(snapshot_texture);
+			snapshot_texture = nullptr;
+		}
+		if (tiles_vb) {
+			gs_vertexbuffer_destroy(tiles_vb);
+			tiles_vb = nullptr;
+			tiles_vb_size = 0;
+		}
 		obs_leave_graphics();
 	}
 
@@ -128,7 +354,21 @@ struct BrowserSource {
 
 	void Update(obs_data_t *settings = nullptr);
 	void Tick();
+	void UpdateDeviceScale();
 	void Render();
+	void ConsumeFrame(FrameQueue &queue, gs_texture_t *&tex, gs_color_format format, std::vector<FrameRect> &valid,
+			  bool whole = false);
+	void RenderPopup();
+	void RenderSnapshot(bool flip);
+	bool SnapshotDue();
+	void TakeSnapshot();
+	void StartLoop();
+	void RenderLoop();
+	void UpdateVideoSource();
+	void RenderAsyncVideo();
+	void EnumActiveSources(obs_source_enum_proc_t cb, void *param);
+	CpuFrame *GetVisibleBounds(FrameRect &bounds);
+	void DrawTiles(gs_effect_t *effect, const char *tech, gs_texture_t *tex, const std::vector<FrameRect> &live);
 #if CHROME_VERSION_BUILD < 4103
 	void ClearAudioStreams();
 	void EnumAudioStreams(obs_source_enum_proc_t cb, void *param);
@@ -145,6 +385,50 @@ struct BrowserSource {
 	void SetShowing(bool showing);
 	void SetActive(bool active);
 	void Refresh();
+	void GetStats(obs_data_t *data);
+
+	/* Any thread: a real paint, input or event reached the page, back to
+	 * full rate if it was idle */
+	void MarkActivity();
+	/* Any thread, after an input event was sent to the page */
+	void MarkInput();
+	/* CEF UI thread, a frame with new content was painted */
+	void MarkPaint();
+	bool Boosted();
+	/* frame rate of the source's tier, or 0 for no limit */
+	double TierFrameRate();
+	double EffectiveFrameRate();
+	void ApplyFrameRate();
+	/* Video thread, once per tick */
+	void UpdateFrameRate();
+	/* Video thread: whether the begin frame of this OBS frame is sent,
+	 * decimating them down to frame_rate */
+	bool TakeBeginFrame(double video_fps);
+
+	/* CEF UI thread, from the page's setFrameRate, pause, resume and
+	 * requestFrame calls.  A rate of 0 or less removes the cap. */
+	void SetPageFrameRate(double rate);
+	void SetPagePaused(bool paused);
+	void RequestPageFrame();
+	/* CEF UI thread, a new document starts without page control */
+	void ResetPageControl();
+	/* CEF UI thread, called with each view paint while a requested frame
+	 * is pending */
+	void FinishPageFrame();
+
+	/* Asks for a copy of the next painted frame; the view is invalidated
+	 * so that it comes even if the page is idle.  Without a browser, the
+	 * frozen, replayed or last frame is returned right away, or nullptr
+	 * if there is none.  Returns an invalid future if frames are not
+	 * painted on the CPU. */
+	std::future<std::shared_ptr<FrameSnapshot>> RequestFrameSnapshot(uint64_t &id);
+	/* Drops a request that timed out */
+	void CancelFrameSnapshot(uint64_t id);
+	/* Copy of the frame shown while there is no browser, with the
+	 * graphics context entered */
+	std::shared_ptr<FrameSnapshot> GetShownFrameSnapshot();
+	/* CEF UI thread, called with each view paint */
+	void ServeFrameSnapshots(const uint8_t *data, uint32_t cx, uint32_t cy);
 
 #if defined(BROWSER_EXTERNAL_BEGIN_FRAME_ENABLED) && defined(ENABLE_BROWSER_SHARED_TEXTURE)
 	inline void SignalBeginFrame();
@@ -153,3 +437,16 @@ struct BrowserSource {
 	void SetBrowser(CefRefPtr<CefBrowser> b);
 	CefRefPtr<CefBrowser> GetBrowser();
 };
+
+void SendBeginFrames();
+
+/* Module-wide frame rate tiers, applied to sources using the global policy.
+ * Set takes the enabled, preview_fps and hidden_fps fields that are present. */
+void SetFrameRatePolicy(obs_data_t *data);
+void GetFrameRatePolicy(obs_data_t *data);
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+/* CPU governor thread: the state of all sources, and the limits it set */
+void CollectCpuGovernorSources(std::vector<CpuGovernorSource> &sources);
+void ApplyCpuGovernorLimits(const std::vector<CpuGovernorSource> &sources);
+#endif
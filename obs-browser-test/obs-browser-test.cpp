@@ -0,0 +1,642 @@
+/******************************************************************************
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+/* Checks the frame processing code that does not need a browser or a
+ * graphics device, mainly that the SIMD kernels match their scalar
+ * versions, and times them along with the snapshot workers:
+ *
+ *   obs-browser-test [--bench]
+ *
+ * Exits with 1 if a check fails.  Built with ENABLE_BROWSER_TESTS. */
+
+#include "browser-convert.hpp"
+#include "browser-frame.hpp"
+#include "browser-frame-hash.hpp"
+#include "browser-loop.hpp"
+#include "browser-snapshot.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+#include "browser-dmabuf-cache.hpp"
+#endif
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                                   \
+	do {                                                               \
+		if (!(cond)) {                                             \
+			fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+			fprintf(stderr, __VA_ARGS__);                      \
+			fputc('\n', stderr);                               \
+			failures++;                                        \
+		}                                                          \
+	} while (false)
+
+static std::mt19937 rng(1234);
+
+static std::vector<uint8_t> RandomBytes(size_t size)
+{
+	std::vector<uint8_t> data(size);
+	for (uint8_t &byte : data)
+		byte = (uint8_t)rng();
+	return data;
+}
+
+/* milliseconds per call of func, over enough calls to take ~200ms */
+template<typename F> static double TimeMs(F func)
+{
+	using clock = std::chrono::steady_clock;
+
+	func();
+
+	int calls = 0;
+	const clock::time_point start = clock::now();
+	clock::duration elapsed;
+	do {
+		func();
+		calls++;
+		elapsed = clock::now() - start;
+	} while (elapsed < std::chrono::milliseconds(200));
+
+	return std::chrono::duration<double, std::milli>(elapsed).count() / calls;
+}
+
+static void PrintTime(const char *name, double ms, size_t bytes)
+{
+	printf("  %-32s %8.3f ms  %7.2f GB/s\n", name, ms, (double)bytes / (ms * 1e6));
+}
+
+/* ------------------------------------------------------------------------- */
+
+static const struct {
+	HashKernel kernel;
+	const char *name;
+} hash_kernels[] = {
+	{HashKernel::Scalar, "scalar"},
+	{HashKernel::SSE2, "sse2"},
+	{HashKernel::AVX2, "avx2"},
+};
+
+static void TestHashKernels()
+{
+	const uint32_t widths[] = {1, 7, 8, 9, 128, 129, 1920};
+	const uint32_t heights[] = {1, 2, 17, 128};
+
+	for (uint32_t cx : widths) {
+		for (uint32_t cy : heights) {
+			const uint32_t linesize = cx * 4 + 12;
+			const std::vector<uint8_t> data = RandomBytes((size_t)linesize * cy);
+			const uint64_t expected =
+				HashFrameRegion(data.data(), linesize, cx * 4, cy, HashKernel::Scalar);
+
+			for (const auto &kernel : hash_kernels) {
+				if (!HashKernelSupported(kernel.kernel))
+					continue;
+
+				const uint64_t hash = HashFrameRegion(data.data(), linesize, cx * 4, cy, kernel.kernel);
+				CHECK(hash == expected, "%s hash of %ux%u differs from scalar", kernel.name, cx, cy);
+			}
+		}
+	}
+}
+
+static std::vector<uint8_t> TileWithPatch(uint32_t x, uint32_t y)
+{
+	std::vector<uint8_t> tile((size_t)FRAME_TILE_SIZE * FRAME_TILE_SIZE * 4, 0);
+
+	for (uint32_t row = y; row < y + 4; row++) {
+		for (uint32_t col = x; col < x + 4; col++)
+			memset(&tile[((size_t)row * FRAME_TILE_SIZE + col) * 4], 0xff, 4);
+	}
+	return tile;
+}
+
+/* the same content elsewhere in a tile is a change */
+static void TestHashPosition()
+{
+	const uint32_t linesize = FRAME_TILE_SIZE * 4;
+	const std::vector<uint8_t> base = TileWithPatch(20, 20);
+	const struct {
+		uint32_t x, y;
+	} moves[] = {{21, 20}, {20, 21}, {28, 20}, {36, 20}, {20, 28}, {84, 20}, {20, 84}};
+
+	for (const auto &kernel : hash_kernels) {
+		if (!HashKernelSupported(kernel.kernel))
+			continue;
+
+		const uint64_t hash =
+			HashFrameRegion(base.data(), linesize, linesize, FRAME_TILE_SIZE, kernel.kernel);
+
+		for (const auto &move : moves) {
+			const std::vector<uint8_t> moved = TileWithPatch(move.x, move.y);
+			const uint64_t moved_hash =
+				HashFrameRegion(moved.data(), linesize, linesize, FRAME_TILE_SIZE, kernel.kernel);
+			CHECK(moved_hash != hash, "%s hash unchanged by moving a patch to %u,%u", kernel.name, move.x,
+			      move.y);
+		}
+	}
+
+	/* and is not dropped as a duplicate frame */
+	FrameTiles tiles;
+	std::vector<FrameRect> rects;
+	tiles.Update(base.data(), linesize, FRAME_TILE_SIZE, FRAME_TILE_SIZE, rects);
+
+	const std::vector<uint8_t> moved = TileWithPatch(20, 21);
+	rects.assign(1, FrameRect{20, 20, 4, 5});
+	CHECK(tiles.Update(moved.data(), linesize, FRAME_TILE_SIZE, FRAME_TILE_SIZE, rects),
+	      "moved patch taken for a duplicate frame");
+
+	rects.assign(1, FrameRect{20, 20, 4, 5});
+	CHECK(!tiles.Update(moved.data(), linesize, FRAME_TILE_SIZE, FRAME_TILE_SIZE, rects),
+	      "unchanged frame not taken for a duplicate");
+}
+
+static uint64_t TotalArea(const std::vector<FrameRect> &rects)
+{
+	uint64_t area = 0;
+	for (const FrameRect &rect : rects)
+		area += rect.Area();
+	return area;
+}
+
+/* tiles that become visible again are uploaded whole */
+static void TestUncoveredRects()
+{
+	const FrameRect run{0, 128, 512, 128};
+	const std::vector<FrameRect> live(1, run);
+	std::vector<FrameRect> rects;
+
+	AddUncoveredRects(rects, live, {});
+	CHECK(rects.size() == 1 && rects[0].x == 0 && rects[0].cx == 512, "run not uploaded without a previous frame");
+
+	rects.clear();
+	AddUncoveredRects(rects, live, live);
+	CHECK(rects.empty(), "run covered by itself uploaded");
+
+	rects.clear();
+	AddUncoveredRects(rects, live, {FrameRect{0, 0, 1920, 1080}});
+	CHECK(rects.empty(), "run covered by a full frame uploaded");
+
+	/* the middle two tiles were transparent */
+	rects.clear();
+	AddUncoveredRects(rects, live, {FrameRect{0, 128, 128, 128}, FrameRect{384, 128, 128, 128}});
+	CHECK(rects.size() == 1 && rects[0].x == 128 && rects[0].cx == 256 && rects[0].y == 128 &&
+		      rects[0].cy == 128,
+	      "tiles that became visible not uploaded");
+
+	/* runs on other rows do not cover it */
+	rects.clear();
+	AddUncoveredRects(rects, live, {FrameRect{0, 0, 512, 128}, FrameRect{0, 256, 512, 128}});
+	CHECK(TotalArea(rects) == run.Area(), "run covered by the rows around it");
+
+	rects.clear();
+	AddUncoveredRects(rects, live, {FrameRect{64, 128, 128, 128}, FrameRect{128, 128, 128, 128}});
+	CHECK(TotalArea(rects) == run.Area() - 192 * 128, "overlapping previous runs miscounted");
+}
+
+/* hashing a frame to find duplicates, against the upload it saves.  The
+ * GPU transfer needs a graphics device; what is timed instead is the part
+ * of the upload on the graphics thread, the copy into the mapped texture.
+ * Its rows are padded to 256 bytes, as D3D11 maps them. */
+static void BenchHash(uint32_t cx, uint32_t cy)
+{
+	const uint32_t linesize = cx * 4;
+	const size_t size = (size_t)linesize * cy;
+	const std::vector<uint8_t> frame = RandomBytes(size);
+
+	printf("frame hash, %ux%u:\n", cx, cy);
+
+	for (const auto &kernel : hash_kernels) {
+		if (!HashKernelSupported(kernel.kernel))
+			continue;
+
+		volatile uint64_t sink = 0;
+		const double ms = TimeMs([&]() {
+			for (uint32_t y = 0; y < cy; y += FRAME_TILE_SIZE) {
+				for (uint32_t x = 0; x < cx; x += FRAME_TILE_SIZE) {
+					const uint32_t tile_cx = std::min((uint32_t)FRAME_TILE_SIZE, cx - x);
+					const uint32_t tile_cy = std::min((uint32_t)FRAME_TILE_SIZE, cy - y);
+					sink = sink + HashFrameRegion(&frame[(size_t)y * linesize + x * 4], linesize,
+								      tile_cx * 4, tile_cy, kernel.kernel);
+				}
+			}
+		});
+		PrintTime(kernel.name, ms, size);
+	}
+
+	FrameTiles tiles;
+	std::vector<FrameRect> rects;
+	tiles.Update(frame.data(), linesize, cx, cy, rects);
+	PrintTime("FrameTiles::Update, full frame", TimeMs([&]() {
+			  rects.assign(1, FrameRect{0, 0, cx, cy});
+			  tiles.Update(frame.data(), linesize, cx, cy, rects);
+		  }),
+		  size);
+
+	const uint32_t mapped_linesize = (linesize + 255) & ~255u;
+	std::vector<uint8_t> mapped((size_t)mapped_linesize * cy);
+	const std::vector<FrameRect> full(1, FrameRect{0, 0, cx, cy});
+	PrintTime("upload copy, full frame",
+		  TimeMs([&]() { CopyFrameRects(mapped.data(), mapped_linesize, frame.data(), linesize, full); }),
+		  size);
+}
+
+/* the scan for visible content, per painted frame, which pages in opaque
+ * mode skip */
+static void BenchAlphaBounds()
+{
+	const uint32_t cx = 1920, cy = 1080, linesize = cx * 4;
+	const size_t size = (size_t)linesize * cy;
+
+	/* every row of a repainted tile is scanned, whether it is a full
+	 * page or an overlay with only a lower third */
+	std::vector<uint8_t> page = RandomBytes(size);
+	for (size_t i = 3; i < size; i += 4)
+		page[i] = 0xff;
+
+	std::vector<uint8_t> overlay(size, 0);
+	memcpy(&overlay[(size_t)linesize * (cy * 2 / 3)], &page[0], (size_t)linesize * (cy / 3));
+
+	printf("visible bounds, 1920x1080 repainted:\n");
+
+	const struct {
+		const char *name;
+		const std::vector<uint8_t> &frame;
+	} frames[] = {{"opaque page", page}, {"lower third overlay", overlay}};
+
+	for (const auto &frame : frames) {
+		AlphaBounds bounds;
+		std::vector<FrameRect> rects(1, FrameRect{0, 0, cx, cy});
+		std::vector<FrameRect> live;
+		PrintTime(frame.name,
+			  TimeMs([&]() { bounds.Update(frame.frame.data(), linesize, cx, cy, rects, live); }), size);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static const struct {
+	ConvertKernel kernel;
+	const char *name;
+} convert_kernels[] = {
+	{ConvertKernel::Scalar, "scalar"},
+	{ConvertKernel::SSE2, "sse2"},
+	{ConvertKernel::AVX2, "avx2"},
+	{ConvertKernel::NEON, "neon"},
+};
+
+/* planes of a 4:2:0 frame, padded so that overruns show up as differences */
+struct YuvFrame {
+	uint32_t y_linesize, uv_linesize;
+	std::vector<uint8_t> y, u, v;
+
+	YuvFrame(uint32_t cx, uint32_t cy, bool nv12)
+		: y_linesize(cx + 5),
+		  uv_linesize((cx + 1) / 2 * (nv12 ? 2 : 1) + 5),
+		  y((size_t)y_linesize * cy, 0x5a),
+		  u((size_t)uv_linesize * ((cy + 1) / 2), 0x5a),
+		  v(u.size(), 0x5a)
+	{
+	}
+
+	bool operator==(const YuvFrame &other) const { return y == other.y && u == other.u && v == other.v; }
+};
+
+static void Convert(const std::vector<uint8_t> &src, uint32_t linesize, uint32_t cx, uint32_t cy, YuvFrame &frame,
+		    bool nv12, bool full_range, ConvertKernel kernel)
+{
+	if (nv12)
+		ConvertBGRAToNV12(src.data(), linesize, cx, cy, frame.y.data(), frame.y_linesize, frame.u.data(),
+				  frame.uv_linesize, full_range, kernel);
+	else
+		ConvertBGRAToI420(src.data(), linesize, cx, cy, frame.y.data(), frame.y_linesize, frame.u.data(),
+				  frame.uv_linesize, frame.v.data(), frame.uv_linesize, full_range, kernel);
+}
+
+static void TestConvertKernels()
+{
+	const struct {
+		uint32_t cx, cy;
+	} sizes[] = {{1, 1},  {1, 2},   {1, 33},   {2, 1},   {3, 3},   {15, 7},   {16, 16},
+		     {17, 5}, {31, 2},  {33, 9},   {47, 1},  {65, 17}, {127, 3},  {1921, 1}};
+
+	for (const auto &size : sizes) {
+		const uint32_t linesize = size.cx * 4 + 8;
+		const std::vector<uint8_t> src = RandomBytes((size_t)linesize * size.cy);
+
+		for (int format = 0; format < 4; format++) {
+			const bool nv12 = format & 1;
+			const bool full_range = format & 2;
+
+			YuvFrame expected(size.cx, size.cy, nv12);
+			Convert(src, linesize, size.cx, size.cy, expected, nv12, full_range, ConvertKernel::Scalar);
+
+			for (const auto &kernel : convert_kernels) {
+				if (!ConvertKernelSupported(kernel.kernel))
+					continue;
+
+				YuvFrame frame(size.cx, size.cy, nv12);
+				Convert(src, linesize, size.cx, size.cy, frame, nv12, full_range, kernel.kernel);
+				CHECK(frame == expected, "%s %s %s range conversion of %ux%u differs from scalar",
+				      kernel.name, nv12 ? "NV12" : "I420", full_range ? "full" : "limited", size.cx,
+				      size.cy);
+			}
+		}
+	}
+}
+
+/* conversion of opaque frames for async video, against the frame time of
+ * the usual output rates */
+static void BenchConvert()
+{
+	const struct {
+		uint32_t cx, cy;
+		int fps;
+	} modes[] = {{1920, 1080, 60}, {3840, 2160, 30}};
+
+	for (const auto &mode : modes) {
+		const uint32_t linesize = mode.cx * 4;
+		const std::vector<uint8_t> src = RandomBytes((size_t)linesize * mode.cy);
+		YuvFrame frame(mode.cx, mode.cy, true);
+
+		printf("BGRA to NV12, %ux%u at %d fps:\n", mode.cx, mode.cy, mode.fps);
+
+		for (const auto &kernel : convert_kernels) {
+			if (!ConvertKernelSupported(kernel.kernel))
+				continue;
+
+			const double ms = TimeMs([&]() {
+				Convert(src, linesize, mode.cx, mode.cy, frame, true, false, kernel.kernel);
+			});
+			printf("  %-32s %8.3f ms  %5.1f%% of the frame time\n", kernel.name, ms,
+			       ms * mode.fps / 10.0);
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+/* hands out made up textures and keeps track of which are alive */
+class FakeDmabufImporter : public DmabufImporter {
+	uintptr_t next = 1;
+
+public:
+	std::set<gs_texture_t *> &alive;
+
+	explicit FakeDmabufImporter(std::set<gs_texture_t *> &alive_) : alive(alive_) {}
+
+	gs_texture_t *Import(const DmabufFrame &) override
+	{
+		gs_texture_t *tex = (gs_texture_t *)next++;
+		alive.insert(tex);
+		return tex;
+	}
+
+	void Destroy(gs_texture_t *tex) override
+	{
+		CHECK(alive.erase(tex) == 1, "texture destroyed twice or never imported");
+	}
+};
+
+/* single plane frame, buffers are told apart by the inode behind the fd */
+static DmabufFrame MakeDmabufFrame(FILE *buffer, uint32_t cx = 1920, uint32_t cy = 1080,
+				   uint32_t drm_format = 0x34325241 /* AR24 */)
+{
+	DmabufFrame frame;
+	frame.cx = cx;
+	frame.cy = cy;
+	frame.drm_format = drm_format;
+	frame.gs_format = GS_BGRA;
+	frame.plane_count = 1;
+	frame.fds[0] = buffer ? fileno(buffer) : -1;
+	frame.strides[0] = cx * 4;
+	return frame;
+}
+
+static void TestDmabufCache()
+{
+	std::vector<FILE *> buffers;
+	for (int i = 0; i < DMABUF_CACHE_SIZE + 2; i++) {
+		FILE *buffer = tmpfile();
+		if (!buffer) {
+			fprintf(stderr, "skipping the dmabuf cache checks, no temporary files\n");
+			for (FILE *f : buffers)
+				fclose(f);
+			return;
+		}
+		buffers.push_back(buffer);
+	}
+
+	std::set<gs_texture_t *> alive;
+	{
+		DmabufTextureCache cache(std::make_unique<FakeDmabufImporter>(alive));
+
+		/* the same buffer is imported once */
+		gs_texture_t *first = cache.Get(MakeDmabufFrame(buffers[0]));
+		CHECK(first && cache.Get(MakeDmabufFrame(buffers[0])) == first, "same buffer imported again");
+		CHECK(cache.hits == 1 && cache.imports == 1, "%llu hits, %llu imports for one buffer",
+		      (unsigned long long)cache.hits, (unsigned long long)cache.imports);
+
+		/* filling the cache keeps all of them */
+		std::vector<gs_texture_t *> textures(1, first);
+		for (int i = 1; i < DMABUF_CACHE_SIZE; i++)
+			textures.push_back(cache.Get(MakeDmabufFrame(buffers[i])));
+		CHECK(cache.Size() == DMABUF_CACHE_SIZE && cache.evictions == 0, "cache not filled");
+
+		/* one more evicts the least recently used, which is not the
+		 * first buffer once it has been used again */
+		cache.Get(MakeDmabufFrame(buffers[0]));
+		gs_texture_t *extra = cache.Get(MakeDmabufFrame(buffers[DMABUF_CACHE_SIZE]));
+		CHECK(cache.Size() == DMABUF_CACHE_SIZE && cache.evictions == 1, "cache grew past its size");
+		CHECK(!cache.Owns(textures[1]) && !alive.count(textures[1]), "least recently used buffer kept");
+		CHECK(cache.Owns(first) && cache.Owns(extra), "recently used buffers evicted");
+		CHECK(alive.size() == cache.Size(), "%zu textures alive for %zu cached", alive.size(), cache.Size());
+
+		/* a resize or format change drops all of them */
+		gs_texture_t *resized = cache.Get(MakeDmabufFrame(buffers[0], 1280, 720));
+		CHECK(cache.Size() == 1 && alive.size() == 1 && alive.count(resized), "buffers kept after a resize");
+
+		cache.Get(MakeDmabufFrame(buffers[0], 1280, 720, 0x34325258 /* XR24 */));
+		CHECK(cache.Size() == 1 && alive.size() == 1, "buffers kept after a format change");
+
+		/* a buffer that cannot be identified lasts a single frame */
+		const DmabufFrame unkeyed = MakeDmabufFrame(nullptr, 1280, 720, 0x34325258);
+		gs_texture_t *once = cache.Get(unkeyed);
+		CHECK(once && cache.Owns(once), "unkeyed buffer not imported");
+		gs_texture_t *again = cache.Get(unkeyed);
+		CHECK(again != once && !alive.count(once), "unkeyed buffer kept for the next frame");
+
+		cache.Get(MakeDmabufFrame(buffers[1], 1280, 720, 0x34325258));
+		CHECK(!alive.count(again), "unkeyed buffer kept for the next frame");
+	}
+	CHECK(alive.empty(), "%zu textures left after the cache was destroyed", alive.size());
+
+	for (FILE *buffer : buffers)
+		fclose(buffer);
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+/* a page that stops painting before the end of the loop: only Tick can
+ * complete the recording, the last frame held until the loop wraps */
+static void TestLoopFinish()
+{
+	const uint32_t cx = 64;
+	const uint32_t cy = 64;
+	const uint32_t linesize = cx * 4;
+	const uint64_t ms = 1000000;
+	const uint64_t duration = 1000 * ms;
+	const size_t max = 16 * 1024 * 1024;
+
+	std::vector<uint8_t> frame(linesize * cy, 0);
+	std::vector<FrameRect> rects = {{0, 0, cx, cy}};
+
+	FrameLoop loop;
+	loop.Record(frame.data(), linesize, cx, cy, rects, 0, duration, max);
+	memset(frame.data(), 0xff, frame.size());
+	loop.Record(frame.data(), linesize, cx, cy, rects, 100 * ms, duration, max);
+
+	CHECK(!loop.Due(999 * ms), "loop due before its duration");
+	loop.Finish(999 * ms);
+	CHECK(loop.GetState() == FrameLoop::State::Recording, "loop finished before its duration");
+
+	CHECK(loop.Due(duration), "held loop not due at its duration");
+	loop.Finish(duration);
+	CHECK(loop.Complete() && !loop.Due(duration), "held loop not finished");
+	CHECK(loop.Frames() == 2, "%zu frames in a loop of 2", loop.Frames());
+
+	bool full;
+	CHECK(loop.Seek(500 * ms, rects, full) && loop.Data()[0] == 0xff, "last frame not held");
+	CHECK(!loop.Seek(999 * ms, rects, full) && loop.Data()[0] == 0xff, "last frame not held to the end");
+	CHECK(loop.Seek(duration + 50 * ms, rects, full) && full && loop.Data()[0] == 0, "loop did not wrap");
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* get_frame_snapshot under load: more clients than the worker pool takes,
+ * each sending its next request as soon as the last one is answered, or a
+ * millisecond after it was refused */
+static void BenchSnapshots()
+{
+	const int clients = SNAPSHOT_MAX_JOBS * 2;
+	const auto duration = std::chrono::seconds(2);
+
+	/* a page-like frame, flat with a noisy lower third */
+	auto snapshot = std::make_shared<FrameSnapshot>();
+	snapshot->cx = 1920;
+	snapshot->cy = 1080;
+	snapshot->data.assign((size_t)snapshot->cx * snapshot->cy * 4, 0x40);
+	const std::vector<uint8_t> noise = RandomBytes(snapshot->data.size() / 3);
+	memcpy(&snapshot->data[snapshot->data.size() - noise.size()], noise.data(), noise.size());
+	for (size_t i = 3; i < snapshot->data.size(); i += 4)
+		snapshot->data[i] = 0xff;
+
+	printf("get_frame_snapshot, 1920x1080 with %d clients:\n", clients);
+
+	const struct {
+		SnapshotFormat format;
+		const char *name;
+	} formats[] = {{SnapshotFormat::Raw, "raw"}, {SnapshotFormat::Png, "png"}, {SnapshotFormat::WebP, "webp"}};
+
+	for (const auto &format : formats) {
+		std::string encoded, error;
+		if (!EncodeFrameSnapshot(*snapshot, format.format, -1, encoded, error)) {
+			printf("  %-32s %s\n", format.name, error.c_str());
+			continue;
+		}
+
+		std::atomic<uint64_t> answered = 0;
+		std::atomic<uint64_t> refused = 0;
+		const auto end = std::chrono::steady_clock::now() + duration;
+
+		std::vector<std::thread> threads;
+		for (int i = 0; i < clients; i++) {
+			threads.emplace_back([&]() {
+				while (std::chrono::steady_clock::now() < end) {
+					auto promise = std::make_shared<std::promise<size_t>>();
+					std::future<size_t> result = promise->get_future();
+
+					const SnapshotFormat f = format.format;
+					const bool queued = QueueSnapshotJob([snapshot, f, promise]() {
+						std::string out, err;
+						EncodeFrameSnapshot(*snapshot, f, -1, out, err);
+						promise->set_value(out.size());
+					});
+
+					if (queued) {
+						result.get();
+						answered++;
+					} else {
+						refused++;
+						std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					}
+				}
+			});
+		}
+		for (std::thread &thread : threads)
+			thread.join();
+
+		const double seconds = std::chrono::duration<double>(duration).count();
+		printf("  %-32s %8.1f requests/s  %8.1f refused/s  %zu bytes\n", format.name,
+		       (double)answered / seconds, (double)refused / seconds, encoded.size());
+	}
+
+	StopSnapshotWorkers();
+}
+
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+	const bool bench = argc > 1 && strcmp(argv[1], "--bench") == 0;
+
+	TestHashKernels();
+	TestHashPosition();
+	TestUncoveredRects();
+	TestConvertKernels();
+#if !defined(_WIN32) && !defined(__APPLE__)
+	TestDmabufCache();
+#endif
+	TestLoopFinish();
+
+	if (bench) {
+		BenchHash(1280, 720);
+		BenchHash(1920, 1080);
+		BenchHash(3840, 2160);
+		BenchAlphaBounds();
+		BenchConvert();
+		BenchSnapshots();
+	}
+
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+	return 0;
+}